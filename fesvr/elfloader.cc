@@ -36,7 +36,6 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
   assert(IS_ELF_RISCV(*eh64) || IS_ELF_EM_NONE(*eh64));
   assert(IS_ELF_VCURRENT(*eh64));
 
-  std::vector<uint8_t> zeros;
   std::map<std::string, uint64_t> symbols;
 
   #define LOAD_ELF(ehdr_t, phdr_t, shdr_t, sym_t, bswap) do { \
@@ -50,8 +49,7 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
           assert(size >= bswap(ph[i].p_offset) + bswap(ph[i].p_filesz)); \
           memif->write(bswap(ph[i].p_paddr), bswap(ph[i].p_filesz), (uint8_t*)buf + bswap(ph[i].p_offset)); \
         } \
-        zeros.resize(bswap(ph[i].p_memsz) - bswap(ph[i].p_filesz)); \
-        memif->write(bswap(ph[i].p_paddr) + bswap(ph[i].p_filesz), bswap(ph[i].p_memsz) - bswap(ph[i].p_filesz), &zeros[0]); \
+        memif->clear(bswap(ph[i].p_paddr) + bswap(ph[i].p_filesz), bswap(ph[i].p_memsz) - bswap(ph[i].p_filesz)); \
       } \
     } \
     shdr_t* sh = (shdr_t*)(buf + bswap(eh->e_shoff)); \
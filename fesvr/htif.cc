@@ -16,6 +16,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <getopt.h>
+#include <sys/wait.h>
 
 /* Attempt to determine the execution prefix automatically.  autoconf
  * sets PREFIX, and pconfigure sets __PCONFIGURE__PREFIX. */
@@ -43,7 +44,7 @@ static void handle_signal(int sig)
 htif_t::htif_t()
   : mem(this), entry(DRAM_BASE), sig_addr(0), sig_len(0),
     tohost_addr(0), fromhost_addr(0), exitcode(0), stopped(false),
-    syscall_proxy(this)
+    syscall_proxy(this), fanout_jobs(1)
 {
   signal(SIGINT, &handle_signal);
   signal(SIGTERM, &handle_signal);
@@ -112,6 +113,12 @@ std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload,
         memif_t::write(taddr, len, src);
     }
 
+    void clear(addr_t taddr, size_t len) override
+    {
+      if (!htif->is_address_preloaded(taddr, len))
+        memif_t::clear(taddr, len);
+    }
+
    private:
     htif_t* htif;
   } preload_aware_memif(this);
@@ -216,6 +223,72 @@ int htif_t::run()
   return exit_code();
 }
 
+void htif_t::set_fanout(const std::vector<std::vector<std::string>>& args, size_t jobs)
+{
+  fanout_args = args;
+  fanout_jobs = std::max(jobs, size_t(1));
+}
+
+size_t htif_t::fan_out()
+{
+  if (fanout_args.empty())
+    return 0;
+
+  prepare_to_fork();
+  // unflushed output would otherwise be written once by every child
+  fflush(NULL);
+  std::cout.flush();
+  std::cerr.flush();
+
+  std::map<pid_t, size_t> running;
+  std::vector<int> status(fanout_args.size());
+  auto reap = [&] {
+    int wstatus;
+    pid_t pid = wait(&wstatus);
+    if (pid < 0)
+      throw std::runtime_error("fan-out: wait failed");
+    status[running[pid]] = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus)
+                                               : 128 + WTERMSIG(wstatus);
+    running.erase(pid);
+  };
+
+  for (size_t i = 0; i < fanout_args.size(); i++) {
+    if (running.size() == fanout_jobs)
+      reap();
+
+    pid_t pid = fork();
+    if (pid < 0)
+      throw std::runtime_error("fan-out: fork failed");
+    if (pid == 0) {
+      targs = fanout_args[i];
+      fanout_args.clear();
+      after_fork(i + 1);
+      return i + 1;
+    }
+    running[pid] = i;
+  }
+  while (!running.empty())
+    reap();
+
+  // the parent stands in for its children from here on
+  size_t failed = 0;
+  int code = 0;
+  for (size_t i = 0; i < status.size(); i++) {
+    if (status[i] == 0)
+      continue;
+    std::cerr << "fork " << i + 1 << " (" << fanout_args[i][0]
+              << ") exited with code " << status[i] << std::endl;
+    if (failed++ == 0)
+      code = status[i];
+  }
+  if (failed)
+    std::cerr << failed << " of " << status.size() << " forks failed" << std::endl;
+
+  fanout_args.clear();
+  request_exit(code);
+  return 0;
+}
+
 bool htif_t::done()
 {
   return stopped;
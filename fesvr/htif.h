@@ -27,6 +27,13 @@ class htif_t : public chunked_memif_t
 
   virtual memif_t& memif() { return mem; }
 
+  // Configure fan-out: when the run reaches a fork point, it splits into one
+  // child process per entry of args, each of which continues from the same
+  // state with that entry as its target arguments. At most jobs children run
+  // at once. Target memory must be private to the process for the children
+  // to be independent.
+  void set_fanout(const std::vector<std::vector<std::string>>& args, size_t jobs);
+
  protected:
   virtual void reset() = 0;
 
@@ -45,6 +52,21 @@ class htif_t : public chunked_memif_t
 
   reg_t get_entry_point() { return entry; }
 
+  // end the run as if the target had exited with the given code
+  void request_exit(int code) { exitcode = (code << 1) | 1; }
+
+  // Split into the configured fan-out children. Returns the child's index,
+  // counting from 1, in each child; in the parent, waits for the children,
+  // ends the run with their combined status and returns 0. Returns 0
+  // without forking if there is no fan-out to do.
+  size_t fan_out();
+  // called before forking, to stop any host threads that fork won't copy
+  virtual void prepare_to_fork() {}
+  // called in each fan-out child, with its index, right after forking
+  virtual void after_fork(size_t child) {}
+  // called when the target passes a marker value with the mark syscall
+  virtual void mark(uint64_t value) {}
+
   // indicates that the initial program load can skip writing this address
   // range to memory, because it has already been loaded through a sideband
   virtual bool is_address_preloaded(addr_t taddr, size_t len) { return false; }
@@ -72,6 +94,8 @@ class htif_t : public chunked_memif_t
   bcd_t bcd;
   std::vector<device_t*> dynamic_devices;
   std::vector<std::string> payloads;
+  std::vector<std::vector<std::string>> fanout_args;
+  size_t fanout_jobs;
 
   const std::vector<std::string>& target_args() { return targs; }
 
@@ -83,6 +83,26 @@ void memif_t::write(addr_t addr, size_t len, const void* bytes)
   }
 }
 
+void memif_t::clear(addr_t addr, size_t len)
+{
+  size_t align = cmemif->chunk_align();
+  uint8_t zeros[align];
+  memset(zeros, 0, align);
+
+  // partial chunks at either end are read-modify-written
+  size_t head = std::min(len, (align - size_t(addr & (align-1))) & (align-1));
+  write(addr, head, zeros);
+  addr += head;
+  len -= head;
+
+  size_t tail = len & (align-1);
+  write(addr + len - tail, tail, zeros);
+  len -= tail;
+
+  if (len)
+    cmemif->clear_chunk(addr, len);
+}
+
 #define MEMIF_READ_FUNC \
   if(addr & (sizeof(val)-1)) \
     throw std::runtime_error("misaligned address"); \
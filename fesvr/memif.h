@@ -30,6 +30,8 @@ public:
   // read and write byte arrays
   virtual void read(addr_t addr, size_t len, void* bytes);
   virtual void write(addr_t addr, size_t len, const void* bytes);
+  // zero a byte array
+  virtual void clear(addr_t addr, size_t len);
 
   // read and write 8-bit words
   virtual uint8_t read_uint8(addr_t addr);
@@ -73,6 +73,8 @@ syscall_t::syscall_t(htif_t* htif)
   table[93] = &syscall_t::sys_exit;
   table[1039] = &syscall_t::sys_lstat;
   table[2011] = &syscall_t::sys_getmainvars;
+  table[2012] = &syscall_t::sys_fanout;
+  table[2013] = &syscall_t::sys_mark;
 
   register_command(0, std::bind(&syscall_t::handle_syscall, this, _1), "syscall");
 
@@ -323,6 +325,22 @@ reg_t syscall_t::sys_getmainvars(reg_t pbuf, reg_t limit, reg_t a2, reg_t a3, re
   return 0;
 }
 
+// Splits the run into the fan-out children configured on the host, if any.
+// Each child sees its index, counting from 1, and can then fetch its own
+// arguments with getmainvars; with no fan-out configured, this returns 0.
+reg_t syscall_t::sys_fanout(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
+{
+  return htif->fan_out();
+}
+
+// Passes a marker value to the host, e.g. to open or close a window of
+// logging.
+reg_t syscall_t::sys_mark(reg_t value, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
+{
+  htif->mark(value);
+  return 0;
+}
+
 reg_t syscall_t::sys_chdir(reg_t path, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
 {
   size_t size = 0;
@@ -0,0 +1,58 @@
+// See LICENSE for license details.
+
+#include "bbv.h"
+#include <string.h>
+#include <errno.h>
+#include <stdexcept>
+
+bbv_t::bbv_t(const std::string& path, uint64_t interval)
+  : path(path), interval(interval), interval_insns(0), current(NULL),
+    resume_pc(-1)
+{
+  file = fopen(path.c_str(), "w");
+  if (!file)
+    throw std::runtime_error(path + ": " + strerror(errno));
+}
+
+void bbv_t::reopen(const std::string& path)
+{
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f)
+    throw std::runtime_error(path + ": " + strerror(errno));
+  fclose(file);
+  file = f;
+  this->path = path;
+}
+
+bbv_t::~bbv_t()
+{
+  if (interval_insns)
+    write_interval();
+  fclose(file);
+}
+
+// The last run of instructions may have gone past the end of the interval;
+// those past it count toward the next one, as on the slow path.
+void bbv_t::end_intervals()
+{
+  while (interval_insns >= interval) {
+    uint64_t over = interval_insns - interval;
+    *current -= over;
+    write_interval();
+    *current += over;
+    interval_insns = over;
+  }
+}
+
+void bbv_t::write_interval()
+{
+  fputc('T', file);
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (blocks[i]) {
+      fprintf(file, ":%zu:%" PRIu64 " ", i + 1, blocks[i]);
+      blocks[i] = 0;
+    }
+  }
+  fputc('\n', file);
+  interval_insns = 0;
+}
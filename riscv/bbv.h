@@ -0,0 +1,60 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_BBV_H
+#define _RISCV_BBV_H
+
+#include "decode.h"
+#include "block_counters.h"
+#include <stdio.h>
+#include <string>
+
+// Basic-block vectors for SimPoint: how many instructions ran in each basic
+// block, written out in the .bb format once per interval of instructions.
+// Blocks are identified by their starting virtual address, and run until an
+// instruction that doesn't fall through or that traps, wherever the block
+// cache or the end of a step cuts them. Each block of the processor's block
+// cache holds a pointer to the counter of the basic block starting there.
+class bbv_t
+{
+public:
+  bbv_t(const std::string& path, uint64_t interval);
+  ~bbv_t();
+
+  // write later intervals to path instead, as a forked child does
+  void reopen(const std::string& path);
+  const std::string& get_path() const { return path; }
+
+  // Count insns that ran from pc on. If the last ones fell through to pc,
+  // these carry on with the same basic block; otherwise they start the block
+  // at pc, whose counter is looked up into *cached unless already there.
+  // next_pc is where the last of them fell through to, or -1 if it didn't.
+  void add(reg_t pc, uint64_t** cached, uint64_t insns, reg_t next_pc)
+  {
+    if (pc != resume_pc) {
+      if (!*cached)
+        *cached = blocks.counter(pc);
+      current = *cached;
+    }
+    *current += insns;
+    resume_pc = next_pc;
+    if ((interval_insns += insns) >= interval)
+      end_intervals();
+  }
+
+  // the current basic block ends here, as at a trap
+  void end_block() { resume_pc = -1; }
+
+private:
+  std::string path;
+  FILE* file;
+  uint64_t interval;
+  uint64_t interval_insns;
+  uint64_t* current; // the counter of the basic block being run
+  reg_t resume_pc; // where that block carries on, or -1 if it has ended
+  block_counters_t blocks; // numbered one less than their block IDs
+
+  void end_intervals();
+  void write_interval();
+};
+
+#endif
@@ -0,0 +1,42 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_BLOCK_COUNTERS_H
+#define _RISCV_BLOCK_COUNTERS_H
+
+#include "decode.h"
+#include <deque>
+#include <unordered_map>
+
+// Instruction counters by basic block, keyed by the block's first PC and
+// numbered from zero in the order the blocks were first seen. Each block of
+// the processor's block cache holds a pointer to its counter, so the
+// registry is only consulted when a block is first decoded.
+class block_counters_t
+{
+public:
+  // the counter for the block starting at pc, which stays valid
+  uint64_t* counter(reg_t pc)
+  {
+    auto it = ids.emplace(pc, counts.size());
+    if (it.second)
+      counts.push_back(0);
+    return &counts[it.first->second];
+  }
+
+  // the counters by block number
+  size_t size() const { return counts.size(); }
+  uint64_t& operator[](size_t id) { return counts[id]; }
+
+  // call f(pc, count) for each block
+  template<typename F> void for_each(F f) const
+  {
+    for (auto& id : ids)
+      f(id.first, counts[id.second]);
+  }
+
+private:
+  std::unordered_map<reg_t, size_t> ids;
+  std::deque<uint64_t> counts; // pointers to these must stay valid
+};
+
+#endif
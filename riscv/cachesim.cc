@@ -49,6 +49,13 @@ void cache_sim_t::init()
     idx_shift++;
 
   tags = new uint64_t[sets*ways]();
+  clear_stats();
+
+  miss_handler = NULL;
+}
+
+void cache_sim_t::clear_stats()
+{
   read_accesses = 0;
   read_misses = 0;
   bytes_read = 0;
@@ -56,8 +63,6 @@ void cache_sim_t::init()
   write_misses = 0;
   bytes_written = 0;
   writebacks = 0;
-
-  miss_handler = NULL;
 }
 
 cache_sim_t::cache_sim_t(const cache_sim_t& rhs)
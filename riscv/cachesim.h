@@ -28,6 +28,7 @@ class cache_sim_t
 
   void access(uint64_t addr, size_t bytes, bool store);
   void print_stats();
+  void clear_stats();
   void set_miss_handler(cache_sim_t* mh) { miss_handler = mh; }
   void set_log(bool _log) { log = _log; }
 
@@ -94,6 +95,10 @@ class cache_memtracer_t : public memtracer_t
   {
     cache->set_log(log);
   }
+  cache_sim_t* get_cache()
+  {
+    return cache;
+  }
 
  protected:
   cache_sim_t* cache;
@@ -0,0 +1,129 @@
+// See LICENSE for license details.
+
+#include "callgraph.h"
+#include "profile.h"
+#include <stdio.h>
+
+callgraph_t::callgraph_t(unsigned xlen)
+  : xlen(xlen), ctx_prv(PRV_M), ctx_satp(0)
+{
+  ctx = &contexts[std::make_pair(ctx_prv, ctx_satp)];
+  cursor = &ctx->root;
+}
+
+callgraph_t::node_t* callgraph_t::node_t::callee(reg_t pc)
+{
+  auto& node = callees[pc];
+  if (!node)
+    node.reset(new node_t(this, pc));
+  return node.get();
+}
+
+void callgraph_t::switch_context(reg_t prv, reg_t satp)
+{
+  ctx_prv = prv;
+  ctx_satp = satp;
+  // M-mode doesn't translate, so its stack is the same whatever satp holds
+  ctx = &contexts[std::make_pair(prv, prv == PRV_M ? 0 : satp)];
+  cursor = ctx->stack.empty() ? &ctx->root : ctx->stack.back().node;
+}
+
+void callgraph_t::trap(reg_t prv, reg_t satp, reg_t handler)
+{
+  enter(prv, satp);
+  push(handler, TRAP_FRAME);
+}
+
+void callgraph_t::jump(insn_t insn, reg_t npc, const reg_t* xpr)
+{
+  if (insn.bits() == 0x10200073 || insn.bits() == 0x30200073) {
+    // sret or mret
+    pop_to(TRAP_FRAME);
+    return;
+  }
+
+  // the jump as jal (rs1 of 0) or jalr
+  reg_t rd, rs1;
+  if ((insn.bits() & 0x7f) == 0x6f) {
+    rd = insn.rd(), rs1 = 0;
+  } else if ((insn.bits() & 0x7f) == 0x67) {
+    rd = insn.rd(), rs1 = insn.rs1();
+  } else if ((insn.bits() & 0x3) == 0x2) {
+    if (insn.rvc_rs1() == 0 || insn.rvc_rs2() != 0)
+      return; // c.mv, c.add or c.ebreak
+    rd = (insn.bits() & 0x1000) ? 1 : 0, rs1 = insn.rvc_rs1();
+  } else {
+    if (xlen != 32)
+      return; // c.addiw
+    rd = 1, rs1 = 0;
+  }
+
+  auto is_link = [](reg_t r) { return r == 1 || r == 5; };
+  if (is_link(rd)) {
+    // a coroutine swap returns through one link register and calls
+    // through the other
+    if (is_link(rs1) && rs1 != rd && !ctx->stack.empty() &&
+        ctx->stack.back().ret != TRAP_FRAME)
+      pop_to(ctx->stack.back().ret);
+    push(npc, xpr[rd]);
+  } else if (is_link(rs1)) {
+    pop_to(npc);
+  }
+}
+
+void callgraph_t::push(reg_t target, reg_t ret)
+{
+  // beyond this, calls are counted in their caller, and their returns
+  // find no frame to pop
+  if (ctx->stack.size() == MAX_DEPTH)
+    return;
+
+  cursor = cursor->callee(target);
+  ctx->stack.push_back({cursor, ret});
+}
+
+void callgraph_t::pop_to(reg_t ret)
+{
+  // Returns that match no frame, as after a longjmp into a frame that was
+  // never seen, leave the stack as it is. Otherwise, frames skipped by the
+  // return (calls that didn't return, like tail calls out of a function
+  // that was itself called) are popped with the one that matches.
+  for (size_t i = ctx->stack.size(); i > 0; i--) {
+    if (ctx->stack[i-1].ret == ret) {
+      ctx->stack.resize(i-1);
+      cursor = ctx->stack.empty() ? &ctx->root : ctx->stack.back().node;
+      return;
+    }
+    if (ctx->stack[i-1].ret == TRAP_FRAME)
+      return; // don't return out of a trap handler
+  }
+}
+
+void callgraph_t::fold(const node_t* node, const std::string& prefix,
+                       std::map<std::string, uint64_t>& stacks,
+                       const std::map<reg_t, std::string>& symbols) const
+{
+  if (node->insns)
+    stacks[prefix] += node->insns;
+  for (auto& callee : node->callees)
+    fold(callee.second.get(), prefix + ";" + symbolize(callee.first, symbols),
+         stacks, symbols);
+}
+
+void callgraph_t::fold_into(std::map<std::string, uint64_t>& stacks,
+                            const std::map<reg_t, std::string>& symbols) const
+{
+  for (auto& c : contexts) {
+    reg_t prv = c.first.first, satp = c.first.second;
+    char root[64];
+    if (prv == PRV_M)
+      snprintf(root, sizeof(root), "[M]");
+    else if (prv == PRV_S)
+      snprintf(root, sizeof(root), "[S]");
+    else if (satp == 0)
+      snprintf(root, sizeof(root), "[U]");
+    else
+      snprintf(root, sizeof(root), "[U satp=0x%" PRIx64 "]", satp);
+    fold(&c.second.root, root, stacks, symbols);
+  }
+}
@@ -0,0 +1,105 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CALLGRAPH_H
+#define _RISCV_CALLGRAPH_H
+
+#include "decode.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A shadow call stack per hart, built from the link-register hints of jal
+// and jalr: writing ra or t0 pushes a return address, and jumping through
+// one of them pops it. Instructions are counted at the stack they ran in,
+// which gives inclusive counts per function once the stacks are folded.
+//
+// There is a separate stack for each privilege level and (below M-mode)
+// each satp, so that traps and address-space switches resume the stack
+// they interrupted. A trap pushes a frame for its handler, which the xRET
+// that ends the handler pops along with anything above it.
+class callgraph_t
+{
+public:
+  callgraph_t(unsigned xlen);
+
+  // called before running instructions in the given context
+  void enter(reg_t prv, reg_t satp)
+  {
+    if (unlikely(prv != ctx_prv || satp != ctx_satp))
+      switch_context(prv, satp);
+  }
+
+  // insns instructions ran, the last of which was insn and went to npc;
+  // xpr holds the registers it wrote
+  void retire(insn_t insn, uint64_t insns, reg_t npc, const reg_t* xpr)
+  {
+    cursor->insns += insns;
+    if (unlikely(is_jump(insn)))
+      jump(insn, npc, xpr);
+  }
+
+  // insns instructions ran without jumping, before a trap
+  void retire(uint64_t insns) { cursor->insns += insns; }
+
+  // a trap went to handler in the given context
+  void trap(reg_t prv, reg_t satp, reg_t handler);
+
+  // add the instruction counts to stacks, keyed by their frames'
+  // functions from the outermost, named through symbols and separated by
+  // semicolons
+  void fold_into(std::map<std::string, uint64_t>& stacks,
+                 const std::map<reg_t, std::string>& symbols) const;
+
+private:
+  struct node_t {
+    node_t* parent;
+    reg_t pc; // the function's entry point
+    uint64_t insns;
+    std::map<reg_t, std::unique_ptr<node_t>> callees;
+
+    node_t(node_t* parent, reg_t pc) : parent(parent), pc(pc), insns(0) {}
+    node_t* callee(reg_t pc);
+  };
+
+  struct frame_t {
+    node_t* node;
+    reg_t ret; // return address, or TRAP_FRAME
+  };
+
+  struct context_t {
+    node_t root;
+    std::vector<frame_t> stack;
+    context_t() : root(NULL, 0) {}
+  };
+
+  static const reg_t TRAP_FRAME = reg_t(-1);
+  static const size_t MAX_DEPTH = 1024;
+
+  unsigned xlen;
+  reg_t ctx_prv;
+  reg_t ctx_satp;
+  context_t* ctx;
+  node_t* cursor; // the frame at the top of ctx's stack
+  std::map<std::pair<reg_t, reg_t>, context_t> contexts;
+
+  static bool is_jump(insn_t insn)
+  {
+    // jal, jalr, and the RVC encodings that share quadrant 2 with c.jr and
+    // c.jalr, or quadrant 1 with c.jal
+    return (insn.bits() & 0x77) == 0x67 ||
+           (insn.bits() & 0xe003) == 0x8002 ||
+           (insn.bits() & 0xe003) == 0x2001 ||
+           insn.bits() == 0x10200073 || insn.bits() == 0x30200073;
+  }
+
+  void switch_context(reg_t prv, reg_t satp);
+  void jump(insn_t insn, reg_t npc, const reg_t* xpr);
+  void push(reg_t target, reg_t ret);
+  void pop_to(reg_t ret);
+  void fold(const node_t* node, const std::string& prefix,
+            std::map<std::string, uint64_t>& stacks,
+            const std::map<reg_t, std::string>& symbols) const;
+};
+
+#endif
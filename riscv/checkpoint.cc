@@ -0,0 +1,109 @@
+// See LICENSE for license details.
+
+#include "checkpoint.h"
+#include "mmu.h"
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+
+static const char MAGIC[8] = {'S', 'P', 'I', 'K', 'E', 'C', 'K', 'P'};
+
+checkpoint_t::checkpoint_t(const std::string& path, bool saving)
+  : path(path), save(saving)
+{
+  file = fopen(path.c_str(), saving ? "wb" : "rb");
+  if (!file)
+    throw std::runtime_error(path + ": " + strerror(errno));
+
+  char magic[sizeof MAGIC];
+  memcpy(magic, MAGIC, sizeof magic);
+  bytes(magic, sizeof magic);
+  if (memcmp(magic, MAGIC, sizeof magic) != 0)
+    fail("not a checkpoint");
+  match(VERSION, "checkpoint format version");
+}
+
+checkpoint_t::~checkpoint_t()
+{
+  fclose(file);
+}
+
+void checkpoint_t::fail(const std::string& why)
+{
+  throw std::runtime_error(path + ": " + why);
+}
+
+void checkpoint_t::bytes(void* p, size_t len)
+{
+  size_t done = save ? fwrite(p, 1, len, file) : fread(p, 1, len, file);
+  if (done != len)
+    fail(ferror(file) ? strerror(errno) : "truncated");
+}
+
+void checkpoint_t::tag(const char* name)
+{
+  char buf[8] = {0};
+  memcpy(buf, name, std::min(strlen(name), sizeof buf));
+  char expected[sizeof buf];
+  memcpy(expected, buf, sizeof buf);
+  bytes(buf, sizeof buf);
+  if (memcmp(buf, expected, sizeof buf) != 0)
+    fail(std::string("expected section '") + name + "'");
+}
+
+static bool page_is_zero(const char* page)
+{
+  const uint64_t* p = (const uint64_t*)page;
+  for (size_t i = 0; i < PGSIZE / sizeof(*p); i++)
+    if (p[i])
+      return false;
+  return true;
+}
+
+void checkpoint_t::memory(char* host, size_t len)
+{
+  match(uint64_t(len), "memory size");
+  if (len % PGSIZE != 0)
+    fail("memory size isn't a whole number of pages");
+
+  // a list of (offset, length) extents of nonzero pages, each followed by
+  // its contents and ending with an empty extent
+  if (save) {
+    for (size_t pos = 0; pos < len; ) {
+      if (page_is_zero(host + pos)) {
+        pos += PGSIZE;
+        continue;
+      }
+      uint64_t start = pos, size;
+      while (pos < len && !page_is_zero(host + pos))
+        pos += PGSIZE;
+      size = pos - start;
+      io(start);
+      io(size);
+      bytes(host + start, size);
+    }
+    uint64_t end[2] = {0, 0};
+    io(end);
+    return;
+  }
+
+  // pages outside the extents are cleared, checking first so that pages
+  // that were never touched aren't faulted in
+  size_t pos = 0;
+  while (true) {
+    uint64_t start, size;
+    io(start);
+    io(size);
+    if (size == 0)
+      start = len;
+    if (start < pos || start > len || size > len - start)
+      fail("corrupt memory image");
+    for (; pos < start; pos += PGSIZE)
+      if (!page_is_zero(host + pos))
+        memset(host + pos, 0, PGSIZE);
+    if (size == 0)
+      break;
+    bytes(host + start, size);
+    pos = start + size;
+  }
+}
@@ -0,0 +1,59 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CHECKPOINT_H
+#define _RISCV_CHECKPOINT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+
+// A checkpoint file, open either for saving or for restoring. State moves
+// through io(), which writes a value when saving and reads it back when
+// restoring, so each component describes its layout once for both
+// directions. Values are stored in host byte order.
+class checkpoint_t
+{
+public:
+  static const uint32_t VERSION = 1;
+
+  checkpoint_t(const std::string& path, bool saving);
+  ~checkpoint_t();
+
+  bool saving() { return save; }
+
+  void bytes(void* p, size_t len);
+
+  template<typename T> void io(T& x)
+  {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only plain data can be checkpointed");
+    bytes(&x, sizeof x);
+  }
+
+  // a configuration value that must be the same when restoring
+  template<typename T> void match(T x, const char* what)
+  {
+    T saved = x;
+    io(saved);
+    if (saved != x)
+      fail(std::string("saved with a different ") + what);
+  }
+
+  // a section marker, so that a mismatched file fails where it diverges
+  void tag(const char* name);
+
+  // a memory image, stored as the runs of pages that aren't all zero
+  void memory(char* host, size_t len);
+
+  [[noreturn]] void fail(const std::string& why);
+
+private:
+  std::string path;
+  FILE* file;
+  bool save;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <sys/time.h>
 #include "devices.h"
 #include "processor.h"
+#include "checkpoint.h"
 
 clint_t::clint_t(std::vector<processor_t*>& procs, uint64_t freq_hz, bool real_time)
   : procs(procs), freq_hz(freq_hz), real_time(real_time), mtime(0), mtimecmp(procs.size())
@@ -54,9 +55,11 @@ bool clint_t::store(reg_t addr, size_t len, const uint8_t* bytes)
     memset((uint8_t*)&mask[0] + addr - MSIP_BASE, 0xff, len);
     for (size_t i = 0; i < procs.size(); ++i) {
       if (!(mask[i] & 0xFF)) continue;
-      procs[i]->state.mip &= ~MIP_MSIP;
+      // the target hart may be running on another host thread
       if (!!(msip[i] & 1))
-        procs[i]->state.mip |= MIP_MSIP;
+        __atomic_fetch_or(&procs[i]->state.mip, MIP_MSIP, __ATOMIC_RELAXED);
+      else
+        __atomic_fetch_and(&procs[i]->state.mip, ~reg_t(MIP_MSIP), __ATOMIC_RELAXED);
     }
   } else if (addr >= MTIMECMP_BASE && addr + len <= MTIMECMP_BASE + procs.size()*sizeof(mtimecmp_t)) {
     memcpy((uint8_t*)&mtimecmp[0] + addr - MTIMECMP_BASE, bytes, len);
@@ -87,3 +90,11 @@ void clint_t::increment(reg_t inc)
       procs[i]->state.mip |= MIP_MTIP;
   }
 }
+
+void clint_t::checkpoint(checkpoint_t& c)
+{
+  c.tag("clint");
+  c.io(mtime);
+  for (auto& cmp : mtimecmp)
+    c.io(cmp);
+}
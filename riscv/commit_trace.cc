@@ -0,0 +1,354 @@
+// See LICENSE for license details.
+
+#include "commit_trace.h"
+#include "processor.h"
+#include "byteorder.h"
+#include <cassert>
+#include <chrono>
+#include <errno.h>
+#include <string.h>
+#include <stdexcept>
+
+static const char MAGIC[8] = {'s', 'p', 'i', 'k', 'e', 'c', 't', '1'};
+
+// Item types, with the words that follow each. Widths come from the
+// record, except for vector registers, whose width is VLEN as given by the
+// VCONFIG item that precedes them in the same record.
+enum {
+  ITEM_PC,      // pc, if pc_delta doesn't reach it
+  ITEM_INSN_HI, // bits 32-63 of an instruction longer than 32 bits
+  ITEM_XREG,    // argument rd; value in xlen bits
+  ITEM_FREG,    // argument rd; value in flen bits
+  ITEM_VCONFIG, // vsew, fractional LMUL?, LMUL, vl, VLEN
+  ITEM_VREG,    // argument vd; value in VLEN bits
+  ITEM_LOAD,    // address
+  ITEM_STORE,   // argument size in bytes; address, value
+};
+
+static size_t width_words(int width)
+{
+  return (width + 63) / 64;
+}
+
+void commit_log_print_value(FILE *log_file, int width, const void *data)
+{
+  assert(log_file);
+  const uint64_t *arr = (const uint64_t *)data;
+
+  fprintf(log_file, "0x");
+  for (int idx = width / 64 - 1; idx >= 0; --idx) {
+    fprintf(log_file, "%016" PRIx64, arr[idx]);
+  }
+}
+
+void commit_log_print_value(FILE *log_file,
+                            int width, uint64_t hi, uint64_t lo)
+{
+  assert(log_file);
+
+  switch (width) {
+    case 8:
+      fprintf(log_file, "0x%01" PRIx8, (uint8_t)lo);
+      break;
+    case 16:
+      fprintf(log_file, "0x%04" PRIx16, (uint16_t)lo);
+      break;
+    case 32:
+      fprintf(log_file, "0x%08" PRIx32, (uint32_t)lo);
+      break;
+    case 64:
+      fprintf(log_file, "0x%016" PRIx64, lo);
+      break;
+    case 128:
+      fprintf(log_file, "0x%016" PRIx64 "%016" PRIx64, hi, lo);
+      break;
+    default:
+      abort();
+  }
+}
+
+commit_trace_t::commit_trace_t(const std::string& path)
+  : file(NULL), ring(RING_SIZE), ring_head(0), ring_tail(0),
+    writer_exit(false)
+{
+  open(path);
+}
+
+commit_trace_t::~commit_trace_t()
+{
+  stop();
+  fclose(file);
+}
+
+void commit_trace_t::open(const std::string& path)
+{
+  file = fopen(path.c_str(), "wb");
+  if (!file)
+    throw std::runtime_error(path + ": " + strerror(errno));
+  fwrite(MAGIC, 1, sizeof(MAGIC), file);
+  next_pc.clear();
+}
+
+void commit_trace_t::reopen(const std::string& path)
+{
+  stop();
+  fclose(file);
+  open(path);
+}
+
+void commit_trace_t::record(size_t hart, processor_t* p, reg_t pc, insn_t insn)
+{
+  state_t* state = p->get_state();
+  int xlen = state->last_inst_xlen;
+  int flen = state->last_inst_flen;
+
+  uint16_t nitems = 0;
+  scratch.resize(sizeof(record_t));
+  auto item = [&](uint8_t type, uint8_t arg) {
+    scratch.push_back(type);
+    scratch.push_back(arg);
+    nitems++;
+  };
+  auto word = [&](uint64_t w) {
+    w = to_le(w);
+    scratch.insert(scratch.end(), (uint8_t*)&w, (uint8_t*)(&w + 1));
+  };
+  auto value = [&](int width, const freg_t& v) {
+    word(v.v[0]);
+    if (width_words(width) > 1)
+      word(v.v[1]);
+  };
+
+  if (hart >= next_pc.size())
+    next_pc.resize(hart + 1, 0);
+  int64_t pc_delta = pc - next_pc[hart];
+  if (pc_delta != int32_t(pc_delta)) {
+    item(ITEM_PC, 0);
+    word(pc);
+    pc_delta = 0;
+  }
+  next_pc[hart] = pc + insn.length();
+
+  if (insn.length() > 4) {
+    item(ITEM_INSN_HI, 0);
+    word(insn.bits() >> 32);
+  }
+
+  bool show_vec = false;
+  for (auto& r : state->log_reg_write) {
+    if (r.first == 0)
+      continue;
+
+    int rd = r.first >> 2;
+    int type = r.first & 3;
+    if (!show_vec && type >= 2) {
+      item(ITEM_VCONFIG, 0);
+      word(p->VU.vsew);
+      word(p->VU.vflmul < 0);
+      word(p->VU.vflmul < 0 ? (reg_t)(1 / p->VU.vflmul) : (reg_t)p->VU.vflmul);
+      word(p->VU.vl);
+      word(p->VU.VLEN);
+      show_vec = true;
+    }
+
+    switch (type) {
+      case 0:
+        item(ITEM_XREG, rd);
+        value(xlen, r.second);
+        break;
+      case 1:
+        item(ITEM_FREG, rd);
+        value(flen, r.second);
+        break;
+      case 2: {
+        item(ITEM_VREG, rd);
+        const uint64_t* v = (const uint64_t*)&p->VU.elt<uint8_t>(rd, 0);
+        for (size_t i = 0; i < width_words(p->VU.VLEN); i++)
+          word(v[i]);
+        break;
+      }
+    }
+  }
+
+  for (auto& m : state->log_mem_read) {
+    item(ITEM_LOAD, 0);
+    word(std::get<0>(m));
+  }
+
+  for (auto& m : state->log_mem_write) {
+    item(ITEM_STORE, std::get<2>(m));
+    word(std::get<0>(m));
+    word(std::get<1>(m));
+  }
+
+  record_t r;
+  r.insn = to_le(uint32_t(insn.bits()));
+  r.pc_delta = to_le(int32_t(pc_delta));
+  r.priv = state->last_inst_priv;
+  r.xlen = xlen / 8;
+  r.flen = flen / 8;
+  r.reserved = 0;
+  r.nitems = to_le(nitems);
+  r.hart = to_le(uint16_t(hart));
+  memcpy(&scratch[0], &r, sizeof(r));
+
+  push(scratch);
+}
+
+void commit_trace_t::push(const std::vector<uint8_t>& bytes)
+{
+  if (!writer.joinable()) {
+    writer_exit = false;
+    writer = std::thread(&commit_trace_t::writer_main, this);
+  }
+
+  if (bytes.size() > RING_SIZE) {
+    fprintf(stderr, "commit trace record of %zu bytes is too large\n", bytes.size());
+    abort();
+  }
+
+  size_t tail = ring_tail.load(std::memory_order_relaxed);
+  while (RING_SIZE - (tail - ring_head.load(std::memory_order_acquire)) < bytes.size())
+    std::this_thread::yield();
+
+  size_t offset = tail & (RING_SIZE - 1);
+  size_t first = std::min(bytes.size(), RING_SIZE - offset);
+  memcpy(&ring[offset], &bytes[0], first);
+  memcpy(&ring[0], &bytes[first], bytes.size() - first);
+  ring_tail.store(tail + bytes.size(), std::memory_order_release);
+}
+
+bool commit_trace_t::write_out()
+{
+  size_t head = ring_head.load(std::memory_order_relaxed);
+  size_t tail = ring_tail.load(std::memory_order_acquire);
+  if (head == tail)
+    return false;
+
+  size_t offset = head & (RING_SIZE - 1);
+  size_t first = std::min(tail - head, RING_SIZE - offset);
+  fwrite(&ring[offset], 1, first, file);
+  fwrite(&ring[0], 1, tail - head - first, file);
+  ring_head.store(tail, std::memory_order_release);
+  return true;
+}
+
+void commit_trace_t::writer_main()
+{
+  while (!writer_exit) {
+    if (!write_out())
+      std::this_thread::sleep_for(std::chrono::microseconds(WRITER_SLEEP_US));
+  }
+  write_out();
+  fflush(file);
+}
+
+void commit_trace_t::stop()
+{
+  if (!writer.joinable())
+    return;
+
+  writer_exit = true;
+  writer.join();
+}
+
+bool commit_trace_t::decode(FILE* in, FILE* out)
+{
+  char magic[sizeof(MAGIC)];
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+    return false;
+
+  struct item_t {
+    uint8_t type;
+    uint8_t arg;
+    std::vector<uint64_t> words;
+  };
+
+  std::vector<reg_t> next_pc;
+  std::vector<item_t> items;
+  record_t r;
+  while (fread(&r, 1, sizeof(r), in) == sizeof(r)) {
+    int xlen = r.xlen * 8, flen = r.flen * 8;
+    size_t hart = from_le(r.hart);
+    if (hart >= next_pc.size())
+      next_pc.resize(hart + 1, 0);
+    reg_t pc = next_pc[hart] + from_le(r.pc_delta);
+    insn_bits_t bits = from_le(r.insn);
+
+    size_t vlen = 0;
+    items.resize(from_le(r.nitems));
+    for (auto& it : items) {
+      uint8_t head[2];
+      if (fread(head, 1, sizeof(head), in) != sizeof(head))
+        return false;
+      it.type = head[0];
+      it.arg = head[1];
+
+      size_t nwords;
+      switch (it.type) {
+        case ITEM_PC: case ITEM_INSN_HI: case ITEM_LOAD: nwords = 1; break;
+        case ITEM_XREG: nwords = width_words(xlen); break;
+        case ITEM_FREG: nwords = width_words(flen); break;
+        case ITEM_VCONFIG: nwords = 5; break;
+        case ITEM_VREG: nwords = width_words(vlen); break;
+        case ITEM_STORE: nwords = 2; break;
+        default: return false;
+      }
+      it.words.resize(nwords);
+      if (fread(it.words.data(), sizeof(uint64_t), nwords, in) != nwords)
+        return false;
+      for (auto& w : it.words)
+        w = from_le(w);
+
+      if (it.type == ITEM_PC)
+        pc = it.words[0];
+      else if (it.type == ITEM_INSN_HI)
+        bits |= it.words[0] << 32;
+      else if (it.type == ITEM_VCONFIG)
+        vlen = it.words[4];
+    }
+
+    insn_t insn(bits);
+    next_pc[hart] = pc + insn.length();
+
+    fprintf(out, "%1d ", r.priv);
+    commit_log_print_value(out, xlen, 0, pc);
+    fprintf(out, " (");
+    commit_log_print_value(out, insn.length() * 8, 0, insn.bits());
+    fprintf(out, ")");
+
+    for (auto& it : items) {
+      auto& w = it.words;
+      switch (it.type) {
+        case ITEM_XREG:
+        case ITEM_FREG:
+          fprintf(out, " %c%2d ", it.type == ITEM_XREG ? 'x' : 'f', it.arg);
+          commit_log_print_value(out, it.type == ITEM_XREG ? xlen : flen,
+                                 w.size() > 1 ? w[1] : 0, w[0]);
+          break;
+        case ITEM_VCONFIG:
+          fprintf(out, " e%" PRIu64 " %s%" PRIu64 " l%" PRIu64,
+                  w[0], w[1] ? "mf" : "m", w[2], w[3]);
+          break;
+        case ITEM_VREG:
+          fprintf(out, " v%2d ", it.arg);
+          commit_log_print_value(out, vlen, w.data());
+          break;
+        case ITEM_LOAD:
+          fprintf(out, " mem ");
+          commit_log_print_value(out, xlen, 0, w[0]);
+          break;
+        case ITEM_STORE:
+          fprintf(out, " mem ");
+          commit_log_print_value(out, xlen, 0, w[0]);
+          fprintf(out, " ");
+          commit_log_print_value(out, it.arg << 3, 0, w[1]);
+          break;
+      }
+    }
+    fprintf(out, "\n");
+  }
+
+  return feof(in);
+}
@@ -0,0 +1,77 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_COMMIT_TRACE_H
+#define _RISCV_COMMIT_TRACE_H
+
+#include "decode.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+class processor_t;
+
+// The commit log in binary. After an 8-byte magic number, each retired
+// instruction is a fixed-width record_t followed by its items: an item is a
+// type byte, an argument byte, and a number of 64-bit little-endian words
+// fixed by its type and by the record's widths (see commit_trace.cc). A
+// record's PC is relative to the end of the previous instruction of the
+// same hart, so falling through costs nothing.
+//
+// Records are encoded on the simulation thread into a lock-free ring
+// buffer, which a writer thread drains into the file. decode() turns a
+// trace back into the text of the commit log.
+class commit_trace_t
+{
+public:
+  commit_trace_t(const std::string& path);
+  ~commit_trace_t();
+
+  // the instruction just retired, from the commit log state of p
+  void record(size_t hart, processor_t* p, reg_t pc, insn_t insn);
+
+  // write out everything recorded and stop the writer thread, which the
+  // next record restarts; for forking, after which a child can switch to a
+  // trace of its own with reopen()
+  void stop();
+  void reopen(const std::string& path);
+
+  // returns false if in isn't a valid trace
+  static bool decode(FILE* in, FILE* out);
+
+private:
+  struct record_t {
+    uint32_t insn;     // the low 32 bits
+    int32_t pc_delta;
+    uint8_t priv;
+    uint8_t xlen;      // in bytes
+    uint8_t flen;      // in bytes
+    uint8_t reserved;
+    uint16_t nitems;
+    uint16_t hart;
+  };
+
+  static const size_t RING_SIZE = 1 << 22; // a power of two
+  static const size_t WRITER_SLEEP_US = 200; // when the ring is empty
+
+  FILE* file;
+  std::vector<uint8_t> ring;
+  std::atomic<size_t> ring_head; // next byte to write out
+  std::atomic<size_t> ring_tail; // end of the last whole record
+  std::vector<uint8_t> scratch; // the record being encoded
+  std::vector<reg_t> next_pc; // by hart
+  std::thread writer;
+  std::atomic<bool> writer_exit;
+
+  void open(const std::string& path);
+  void push(const std::vector<uint8_t>& bytes);
+  bool write_out();
+  void writer_main();
+};
+
+// formats a value of width bits, as the commit log does
+void commit_log_print_value(FILE* log_file, int width, const void* data);
+void commit_log_print_value(FILE* log_file, int width, uint64_t hi, uint64_t lo);
+
+#endif
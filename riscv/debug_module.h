@@ -112,6 +112,7 @@ class debug_module_t : public abstract_device_t
 
     bool load(reg_t addr, size_t len, uint8_t* bytes);
     bool store(reg_t addr, size_t len, const uint8_t* bytes);
+    size_t size() { return DEBUG_END - DEBUG_START + 1; }
 
     // Debug Module Interface that the debugger (in our case through JTAG DTM)
     // uses to access the DM.
@@ -16,6 +16,7 @@
 #include "common.h"
 #include "softfloat_types.h"
 #include "specialize.h"
+#include "host_fp.h"
 #include <cinttypes>
 
 typedef int64_t sreg_t;
@@ -173,27 +174,31 @@ private:
 #define RS3 READ_REG(insn.rs3())
 #define WRITE_RD(value) WRITE_REG(insn.rd(), value)
 
-#ifndef RISCV_ENABLE_COMMITLOG
-# define WRITE_REG(reg, value) STATE.XPR.write(reg, value)
-# define WRITE_FREG(reg, value) DO_WRITE_FREG(reg, freg(value))
-# define WRITE_VSTATUS
-#else
-   /* 0 : int
-    * 1 : floating
-    * 2 : vector
-    */
-# define WRITE_REG(reg, value) ({ \
+// Register writes are logged for the commit log if LOG_COMMITS holds. Here
+// it is checked at run time; insn_template.cc instead compiles each
+// instruction twice, with it fixed either way.
+#define LOG_COMMITS (p->get_log_commits_enabled())
+
+/* 0 : int
+ * 1 : floating
+ * 2 : vector
+ */
+#define WRITE_REG(reg, value) ({ \
     reg_t wdata = (value); /* value may have side effects */ \
-    STATE.log_reg_write[(reg) << 2] = {wdata, 0}; \
+    if (LOG_COMMITS) \
+      STATE.log_reg_write[(reg) << 2] = {wdata, 0}; \
     STATE.XPR.write(reg, wdata); \
   })
-# define WRITE_FREG(reg, value) ({ \
+#define WRITE_FREG(reg, value) ({ \
     freg_t wdata = freg(value); /* value may have side effects */ \
-    STATE.log_reg_write[((reg) << 2) | 1] = wdata; \
+    if (LOG_COMMITS) \
+      STATE.log_reg_write[((reg) << 2) | 1] = wdata; \
     DO_WRITE_FREG(reg, wdata); \
   })
-# define WRITE_VSTATUS STATE.log_reg_write[3] = {0, 0};
-#endif
+#define WRITE_VSTATUS ({ \
+    if (LOG_COMMITS) \
+      STATE.log_reg_write[3] = {0, 0}; \
+  })
 
 // RVC macros
 #define WRITE_RVC_RS1S(value) WRITE_REG(insn.rvc_rs1s(), value)
@@ -260,6 +265,9 @@ private:
   require(!is_overlapped_widen(astart, asize, bstart, bsize))
 #define require_vm do { if (insn.v_vm() == 0) require(insn.rd() != 0);} while(0);
 
+// call op, or its host_fp.h version under --host-fp
+#define HOST_FP(op, a, b) (p->get_host_fp() ? host_##op(a, b) : op(a, b))
+
 #define set_fp_exceptions ({ if (softfloat_exceptionFlags) { \
                                dirty_fp_state; \
                                STATE.fflags |= softfloat_exceptionFlags; \
@@ -1014,114 +1022,201 @@ static inline bool is_aligned(const unsigned val, const unsigned pos)
   }
 
 
-// genearl VXI signed/unsgied loop
-#define VI_VV_ULOOP(BODY) \
-  VI_CHECK_SSS(true) \
-  VI_LOOP_BASE \
+// Unmasked loops need no element-by-element bookkeeping: a register group
+// is contiguous in the register file, so they run BODY over flat arrays,
+// in fixed-size chunks that the compiler turns into host SIMD. The bodies
+// only use the element at i, so it doesn't matter that vd may be vs1 or
+// vs2. Logging commits takes the element loop, which records the writes.
+#define VI_FLAT_CHUNK 64 // bytes
+
+#ifdef WORDS_BIGENDIAN
+# define VI_FLAT_OK false
+#else
+# define VI_FLAT_OK (insn.v_vm() == 1 && !LOG_COMMITS)
+#endif
+
+#define VV_FLAT_OPERANDS(k) \
+  T vs1 = vs1_base[k]; \
+  T vs2 = vs2_base[k];
+
+#define VX_FLAT_OPERANDS(k) \
+  T vs2 = vs2_base[k];
+
+#define VI_FLAT_LOOP_SEW(T_, SCALAR, OPERANDS, BODY) \
+  { \
+    typedef T_ T; \
+    T *vd_base = P.VU.elt_group<T>(rd_num); \
+    const T *vs1_base = P.VU.elt_group<T>(rs1_num); \
+    const T *vs2_base = P.VU.elt_group<T>(rs2_num); \
+    SCALAR \
+    const reg_t chunk = VI_FLAT_CHUNK / sizeof(T); \
+    reg_t i = P.VU.vstart; \
+    for (; i + chunk <= vl; i += chunk) { \
+      _Pragma("GCC ivdep") \
+      for (reg_t j = 0; j < chunk; ++j) { \
+        T &vd = vd_base[i + j]; \
+        OPERANDS(i + j) \
+        BODY; \
+      } \
+    } \
+    for (; i < vl; ++i) { \
+      T &vd = vd_base[i]; \
+      OPERANDS(i) \
+      BODY; \
+    } \
+  }
+
+#define VI_FLAT_LOOP(TYPE, SCALAR, OPERANDS, BODY) \
+  require(P.VU.vsew >= e8 && P.VU.vsew <= e64); \
+  require_vector;\
+  reg_t vl = P.VU.vl; \
+  reg_t sew = P.VU.vsew; \
+  reg_t rd_num = insn.rd(); \
+  reg_t rs1_num = insn.rs1(); \
+  reg_t rs2_num = insn.rs2(); \
   if (sew == e8){ \
-    VV_U_PARAMS(e8); \
-    BODY; \
+    VI_FLAT_LOOP_SEW(TYPE<e8>::type, SCALAR, OPERANDS, BODY) \
   }else if(sew == e16){ \
-    VV_U_PARAMS(e16); \
-    BODY; \
+    VI_FLAT_LOOP_SEW(TYPE<e16>::type, SCALAR, OPERANDS, BODY) \
   }else if(sew == e32){ \
-    VV_U_PARAMS(e32); \
-    BODY; \
+    VI_FLAT_LOOP_SEW(TYPE<e32>::type, SCALAR, OPERANDS, BODY) \
   }else if(sew == e64){ \
-    VV_U_PARAMS(e64); \
-    BODY; \
+    VI_FLAT_LOOP_SEW(TYPE<e64>::type, SCALAR, OPERANDS, BODY) \
   } \
-  VI_LOOP_END 
+  P.VU.vstart = 0;
+
+// genearl VXI signed/unsgied loop
+#define VI_VV_ULOOP(BODY) \
+  VI_CHECK_SSS(true) \
+  if (VI_FLAT_OK) { \
+    VI_FLAT_LOOP(type_usew_t, , VV_FLAT_OPERANDS, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VV_U_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VV_U_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VV_U_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VV_U_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
 
 #define VI_VV_LOOP(BODY) \
   VI_CHECK_SSS(true) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VV_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VV_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VV_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VV_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (VI_FLAT_OK) { \
+    VI_FLAT_LOOP(type_sew_t, , VV_FLAT_OPERANDS, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VV_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VV_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VV_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VV_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
 
 #define VI_VX_ULOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VX_U_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VX_U_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VX_U_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VX_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (VI_FLAT_OK) { \
+    VI_FLAT_LOOP(type_usew_t, T rs1 = (T)RS1;, VX_FLAT_OPERANDS, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VX_U_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VX_U_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VX_U_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VX_U_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
 
 #define VI_VX_LOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VX_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VX_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VX_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VX_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (VI_FLAT_OK) { \
+    VI_FLAT_LOOP(type_sew_t, T rs1 = (T)RS1;, VX_FLAT_OPERANDS, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VX_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VX_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VX_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VX_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
 
 #define VI_VI_ULOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VI_U_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VI_U_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VI_U_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VI_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (VI_FLAT_OK) { \
+    VI_FLAT_LOOP(type_usew_t, T zimm5 = (T)insn.v_zimm5();, VX_FLAT_OPERANDS, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VI_U_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VI_U_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VI_U_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VI_U_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
 
 #define VI_VI_LOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VI_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VI_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VI_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VI_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (VI_FLAT_OK) { \
+    VI_FLAT_LOOP(type_sew_t, T simm5 = (T)insn.v_simm5();, VX_FLAT_OPERANDS, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VI_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VI_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VI_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VI_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
 
 // narrow operation loop
 #define VI_VV_LOOP_NARROW(BODY) \
@@ -1618,6 +1713,52 @@ for (reg_t i = 0; i < P.VU.vlmax && P.VU.vl != 0; ++i) { \
   } \
   P.VU.vstart = 0;
 
+// Unit-stride accesses copy each run of whole segments that lies on one
+// page straight between memory and the register file, when the TLB maps
+// the page for direct access. The rest -- masked elements, the first access
+// to a page, I/O, triggers, logged commits -- take the element path, which
+// refills the TLB, or faults with vstart at the element.
+#define VI_UNIT_STRIDE_SPAN(elt_width) \
+  const reg_t seg_bytes = nf * sizeof(elt_width##_t); \
+  const reg_t addr = baseAddr + i * seg_bytes; \
+  const reg_t n = std::min(vl - i, (PGSIZE - addr % PGSIZE) / seg_bytes);
+
+#define VI_LD_UNIT_STRIDE(elt_width) \
+  const reg_t nf = insn.v_nf() + 1; \
+  const reg_t vl = P.VU.vl; \
+  const reg_t baseAddr = RS1; \
+  const reg_t vd = insn.rd(); \
+  VI_CHECK_LOAD(elt_width); \
+  for (reg_t i = 0; i < vl; ++i) { \
+    VI_ELEMENT_SKIP(i); \
+    VI_STRIP(i); \
+    if (VI_FLAT_OK && baseAddr % sizeof(elt_width##_t) == 0) { \
+      VI_UNIT_STRIDE_SPAN(elt_width); \
+      const elt_width##_t *host = n == 0 ? NULL : \
+        (const elt_width##_t*)MMU.load_host_addr(addr, n * seg_bytes); \
+      if (host) { \
+        if (nf == 1) { \
+          memcpy(P.VU.elt_group<elt_width##_t>(vd) + i, host, n * seg_bytes); \
+        } else { \
+          for (reg_t fn = 0; fn < nf; ++fn) { \
+            elt_width##_t *vreg = P.VU.elt_group<elt_width##_t>(vd + fn * emul) + i; \
+            for (reg_t k = 0; k < n; ++k) \
+              vreg[k] = host[k * nf + fn]; \
+          } \
+        } \
+        i += n - 1; \
+        continue; \
+      } \
+    } \
+    P.VU.vstart = i; \
+    for (reg_t fn = 0; fn < nf; ++fn) { \
+      elt_width##_t val = MMU.load_##elt_width( \
+        baseAddr + (i * nf + fn) * sizeof(elt_width##_t)); \
+      P.VU.elt<elt_width##_t>(vd + fn * emul, vreg_inx, true) = val; \
+    } \
+  } \
+  P.VU.vstart = 0;
+
 #define VI_LD_INDEX(elt_width, is_seg) \
   const reg_t nf = insn.v_nf() + 1; \
   const reg_t vl = P.VU.vl; \
@@ -1672,6 +1813,42 @@ for (reg_t i = 0; i < P.VU.vlmax && P.VU.vl != 0; ++i) { \
   } \
   P.VU.vstart = 0;
 
+#define VI_ST_UNIT_STRIDE(elt_width) \
+  const reg_t nf = insn.v_nf() + 1; \
+  const reg_t vl = P.VU.vl; \
+  const reg_t baseAddr = RS1; \
+  const reg_t vs3 = insn.rd(); \
+  VI_CHECK_STORE(elt_width); \
+  for (reg_t i = 0; i < vl; ++i) { \
+    VI_STRIP(i) \
+    VI_ELEMENT_SKIP(i); \
+    if (VI_FLAT_OK && baseAddr % sizeof(elt_width##_t) == 0) { \
+      VI_UNIT_STRIDE_SPAN(elt_width); \
+      elt_width##_t *host = n == 0 ? NULL : \
+        (elt_width##_t*)MMU.store_host_addr(addr, n * seg_bytes); \
+      if (host) { \
+        if (nf == 1) { \
+          memcpy(host, P.VU.elt_group<elt_width##_t>(vs3) + i, n * seg_bytes); \
+        } else { \
+          for (reg_t fn = 0; fn < nf; ++fn) { \
+            const elt_width##_t *vreg = P.VU.elt_group<elt_width##_t>(vs3 + fn * emul) + i; \
+            for (reg_t k = 0; k < n; ++k) \
+              host[k * nf + fn] = vreg[k]; \
+          } \
+        } \
+        i += n - 1; \
+        continue; \
+      } \
+    } \
+    P.VU.vstart = i; \
+    for (reg_t fn = 0; fn < nf; ++fn) { \
+      elt_width##_t val = P.VU.elt<elt_width##_t>(vs3 + fn * emul, vreg_inx); \
+      MMU.store_##elt_width( \
+        baseAddr + (i * nf + fn) * sizeof(elt_width##_t), val); \
+    } \
+  } \
+  P.VU.vstart = 0;
+
 #define VI_ST_INDEX(elt_width, is_seg) \
   const reg_t nf = insn.v_nf() + 1; \
   const reg_t vl = P.VU.vl; \
@@ -2091,6 +2268,118 @@ for (reg_t i = 0; i < P.VU.vlmax && P.VU.vl != 0; ++i) { \
   DEBUG_RVV_FP_VF; \
   VI_VFP_LOOP_END
 
+// Under --host-fp, unmasked single- and double-precision loops that round to
+// nearest-even compute HOST, an expression of host floats, a chunk at a
+// time on the host FPU (see host_fp.h). A chunk whose results or flags
+// might differ from softfloat's is redone element by element with BODY.
+#ifdef HOST_FP_SUPPORTED
+
+#define VI_VFP_HOST_CHUNK 64 // elements
+
+#define VI_VFP_HOST_OK \
+  (p->get_host_fp() && insn.v_vm() == 1 && !LOG_COMMITS && \
+   STATE.frm == softfloat_round_near_even && \
+   (P.VU.vsew == e32 || P.VU.vsew == e64))
+
+#define VFP_HOST_VV_OPERANDS(k) \
+  H vs1 = host_fp(vs1_base[k]); \
+  H vs2 = host_fp(vs2_base[k]);
+
+#define VFP_HOST_VF_OPERANDS(k) \
+  H rs1 = rs1_host; \
+  H vs2 = host_fp(vs2_base[k]);
+
+#define VFP_SOFT_VV_OPERANDS(k) \
+  T vs1 = vs1_base[k]; \
+  T vs2 = vs2_base[k];
+
+#define VFP_SOFT_VF_OPERANDS(k) \
+  T rs1 = rs1_soft; \
+  T vs2 = vs2_base[k];
+
+#define VI_VFP_HOST_LOOP_SEW(T_, H_, RS1, HOST_OPERANDS, SOFT_OPERANDS, BODY, HOST) \
+  { \
+    typedef T_ T; \
+    typedef H_ H; \
+    T *vd_base = P.VU.elt_group<T>(rd_num); \
+    const T *vs1_base = P.VU.elt_group<T>(rs1_num); \
+    const T *vs2_base = P.VU.elt_group<T>(rs2_num); \
+    const T rs1_soft = RS1; \
+    const H rs1_host = host_fp(rs1_soft); \
+    (void)vs1_base; (void)rs1_host; \
+    for (reg_t i = P.VU.vstart; i < vl; i += VI_VFP_HOST_CHUNK) { \
+      const reg_t n = std::min<reg_t>(vl - i, VI_VFP_HOST_CHUNK); \
+      H res[VI_VFP_HOST_CHUNK]; \
+      host_fp_begin(); \
+      if (n == VI_VFP_HOST_CHUNK) { \
+        _Pragma("GCC ivdep") \
+        for (reg_t j = 0; j < VI_VFP_HOST_CHUNK; ++j) { \
+          HOST_OPERANDS(i + j) \
+          res[j] = HOST; \
+        } \
+      } else { \
+        for (reg_t j = 0; j < n; ++j) { \
+          HOST_OPERANDS(i + j) \
+          res[j] = HOST; \
+        } \
+      } \
+      unsigned flags = host_fp_end(res); \
+      bool nan = false; \
+      for (reg_t j = 0; j < n; ++j) \
+        nan |= res[j] != res[j]; \
+      if (!(flags & HOST_FP_REDO) && !nan) { \
+        memcpy(vd_base + i, res, n * sizeof(T)); \
+        softfloat_exceptionFlags |= host_fp_softfloat_flags(flags); \
+        set_fp_exceptions; \
+      } else { \
+        for (reg_t j = i; j < i + n; ++j) { \
+          T &vd = vd_base[j]; \
+          SOFT_OPERANDS(j) \
+          BODY; \
+          set_fp_exceptions; \
+        } \
+      } \
+    } \
+  }
+
+#define VI_VFP_HOST_LOOP(RS1_32, RS1_64, HOST_OPERANDS, SOFT_OPERANDS, BODY32, BODY64, HOST) \
+  VI_VFP_COMMON \
+  if (P.VU.vsew == e32) { \
+    VI_VFP_HOST_LOOP_SEW(float32_t, float, RS1_32, HOST_OPERANDS, SOFT_OPERANDS, BODY32, HOST) \
+  } else { \
+    VI_VFP_HOST_LOOP_SEW(float64_t, double, RS1_64, HOST_OPERANDS, SOFT_OPERANDS, BODY64, HOST) \
+  } \
+  P.VU.vstart = 0;
+
+#define VI_VFP_VV_LOOP_HOST(BODY16, BODY32, BODY64, HOST) \
+  if (VI_VFP_HOST_OK) { \
+    VI_CHECK_SSS(true); \
+    VI_VFP_HOST_LOOP(float32_t(), float64_t(), VFP_HOST_VV_OPERANDS, \
+                     VFP_SOFT_VV_OPERANDS, BODY32, BODY64, HOST) \
+  } else { \
+    VI_VFP_VV_LOOP(BODY16, BODY32, BODY64) \
+  }
+
+#define VI_VFP_VF_LOOP_HOST(BODY16, BODY32, BODY64, HOST) \
+  if (VI_VFP_HOST_OK) { \
+    VI_CHECK_SSS(false); \
+    VI_VFP_HOST_LOOP(f32(READ_FREG(rs1_num)), f64(READ_FREG(rs1_num)), \
+                     VFP_HOST_VF_OPERANDS, VFP_SOFT_VF_OPERANDS, \
+                     BODY32, BODY64, HOST) \
+  } else { \
+    VI_VFP_VF_LOOP(BODY16, BODY32, BODY64) \
+  }
+
+#else
+
+#define VI_VFP_VV_LOOP_HOST(BODY16, BODY32, BODY64, HOST) \
+  VI_VFP_VV_LOOP(BODY16, BODY32, BODY64)
+
+#define VI_VFP_VF_LOOP_HOST(BODY16, BODY32, BODY64, HOST) \
+  VI_VFP_VF_LOOP(BODY16, BODY32, BODY64)
+
+#endif
+
 #define VI_VFP_LOOP_CMP(BODY16, BODY32, BODY64, is_vs1) \
   VI_CHECK_MSS(is_vs1); \
   VI_VFP_LOOP_CMP_BASE \
@@ -1,52 +1,81 @@
 #include "devices.h"
+#include <algorithm>
 
 void bus_t::add_device(reg_t addr, abstract_device_t* dev)
 {
-  // Searching devices via lower_bound/upper_bound
-  // implicitly relies on the underlying std::map 
-  // container to sort the keys and provide ordered
-  // iteration over this sort, which it does. (python's
-  // SortedDict is a good analogy)
-  devices[addr] = dev;
+  region_t region = {addr, 0, dev, NULL};
+  if (auto mem = dynamic_cast<mem_t*>(dev))
+    region.host = mem->contents();
+
+  // keep regions sorted by base address; a device added at an existing
+  // base replaces the old one
+  auto it = std::lower_bound(regions.begin(), regions.end(), addr,
+    [](const region_t& r, reg_t a) { return r.base < a; });
+  if (it != regions.end() && it->base == addr)
+    *it = region;
+  else
+    regions.insert(it, region);
+
+  // a device of unknown size decodes everything up to the next one
+  for (size_t i = 0; i < regions.size(); i++) {
+    reg_t limit = i + 1 < regions.size() ? regions[i + 1].base - regions[i].base
+                                         : -regions[i].base - 1;
+    reg_t size = regions[i].dev->size();
+    regions[i].size = size && size < limit ? size : limit;
+  }
 }
 
-bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+const bus_t::region_t* bus_t::find_region(reg_t addr)
 {
   // Find the device with the base address closest to but
   // less than addr (price-is-right search)
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    // Either the bus is empty, or there weren't 
+  auto it = std::upper_bound(regions.begin(), regions.end(), addr,
+    [](reg_t a, const region_t& r) { return a < r.base; });
+  if (it == regions.begin()) {
+    // Either the bus is empty, or there weren't
     // any items with a base address <= addr
-    return false;
+    return NULL;
   }
-  // Found at least one item with base address <= addr
-  // The iterator points to the device after this, so
-  // go back by one item.
   it--;
-  return it->second->load(addr - it->first, len, bytes);
+  return addr - it->base < it->size ? &*it : NULL;
+}
+
+bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  auto r = find_region(addr);
+  return r && r->dev->load(addr - r->base, len, bytes);
 }
 
 bool bus_t::store(reg_t addr, size_t len, const uint8_t* bytes)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    return false;
-  }
-  it--;
-  return it->second->store(addr - it->first, len, bytes);
+  auto r = find_region(addr);
+  return r && r->dev->store(addr - r->base, len, bytes);
 }
 
 std::pair<reg_t, abstract_device_t*> bus_t::find_device(reg_t addr)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
+  auto r = find_region(addr);
+  if (!r)
     return std::make_pair((reg_t)0, (abstract_device_t*)NULL);
-  }
-  it--;
-  return std::make_pair(it->first, it->second);
+  return std::make_pair(r->base, r->dev);
+}
+
+abstract_device_t* bus_t::find_device(reg_t addr, reg_t* base, reg_t* size)
+{
+  auto r = find_region(addr);
+  if (!r)
+    return NULL;
+  *base = r->base;
+  *size = r->size;
+  return r->dev;
+}
+
+char* bus_t::find_mem(reg_t addr)
+{
+  auto r = find_region(addr);
+  if (r && r->host)
+    return r->host + (addr - r->base);
+  return NULL;
 }
 
 // Type for holding all registered MMIO plugins by name.
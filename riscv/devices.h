@@ -10,11 +10,15 @@
 #include <stdexcept>
 
 class processor_t;
+class checkpoint_t;
 
 class abstract_device_t {
  public:
   virtual bool load(reg_t addr, size_t len, uint8_t* bytes) = 0;
   virtual bool store(reg_t addr, size_t len, const uint8_t* bytes) = 0;
+  // bytes of address space the device decodes; 0 means everything up to
+  // the next device on the bus
+  virtual size_t size() { return 0; }
   virtual ~abstract_device_t() {}
 };
 
@@ -25,9 +29,22 @@ class bus_t : public abstract_device_t {
   void add_device(reg_t addr, abstract_device_t* dev);
 
   std::pair<reg_t, abstract_device_t*> find_device(reg_t addr);
+  // the device decoding addr, and the base and size of its range
+  abstract_device_t* find_device(reg_t addr, reg_t* base, reg_t* size);
+  // the host memory backing addr, or NULL if it isn't plain memory
+  char* find_mem(reg_t addr);
 
  private:
-  std::map<reg_t, abstract_device_t*> devices;
+  // devices sorted by base address, with the range each decodes and the
+  // host memory behind each mem_t resolved once when it is added
+  struct region_t {
+    reg_t base;
+    reg_t size;
+    abstract_device_t* dev;
+    char* host;
+  };
+  std::vector<region_t> regions;
+  const region_t* find_region(reg_t addr);
 };
 
 class rom_device_t : public abstract_device_t {
@@ -36,21 +53,22 @@ class rom_device_t : public abstract_device_t {
   bool load(reg_t addr, size_t len, uint8_t* bytes);
   bool store(reg_t addr, size_t len, const uint8_t* bytes);
   const std::vector<char>& contents() { return data; }
+  size_t size() { return data.size(); }
  private:
   std::vector<char> data;
 };
 
 class mem_t : public abstract_device_t {
  public:
-  mem_t(size_t size) : len(size) {
-    if (!size)
-      throw std::runtime_error("zero bytes of target memory requested");
-    data = (char*)calloc(1, size);
-    if (!data)
-      throw std::runtime_error("couldn't allocate " + std::to_string(size) + " bytes of target memory");
-  }
+  // Memory is mapped, not allocated, so host pages are only committed as
+  // the target touches them. With hugepages, it comes from the hugetlb
+  // pool if that has room and is otherwise marked for transparent huge
+  // pages. If fd is an open file, size bytes of it starting at offset are
+  // mapped shared instead: the file's contents are the initial memory
+  // image, and other processes mapping it see the target's stores.
+  mem_t(size_t size, bool hugepages = false, int fd = -1, size_t offset = 0);
   mem_t(const mem_t& that) = delete;
-  ~mem_t() { free(data); }
+  ~mem_t();
 
   bool load(reg_t addr, size_t len, uint8_t* bytes) { return false; }
   bool store(reg_t addr, size_t len, const uint8_t* bytes) { return false; }
@@ -69,6 +87,7 @@ class clint_t : public abstract_device_t {
   bool store(reg_t addr, size_t len, const uint8_t* bytes);
   size_t size() { return CLINT_SIZE; }
   void increment(reg_t inc);
+  void checkpoint(checkpoint_t& c);
  private:
   typedef uint64_t mtime_t;
   typedef uint64_t mtimecmp_t;
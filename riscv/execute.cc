@@ -2,9 +2,12 @@
 
 #include "processor.h"
 #include "mmu.h"
+#include "bbv.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "commit_trace.h"
 #include <cassert>
 
-#ifdef RISCV_ENABLE_COMMITLOG
 static void commit_log_reset(processor_t* p)
 {
   p->get_state()->log_reg_write.clear();
@@ -20,45 +23,13 @@ static void commit_log_stash_privilege(processor_t* p)
   state->last_inst_flen = p->get_flen();
 }
 
-static void commit_log_print_value(FILE *log_file, int width, const void *data)
-{
-  assert(log_file);
-  const uint64_t *arr = (const uint64_t *)data;
-
-  fprintf(log_file, "0x");
-  for (int idx = width / 64 - 1; idx >= 0; --idx) {
-    fprintf(log_file, "%016" PRIx64, arr[idx]);
-  }
-}
-
-static void commit_log_print_value(FILE *log_file,
-                                   int width, uint64_t hi, uint64_t lo)
+static void commit_log_print_insn(processor_t *p, reg_t pc, insn_t insn)
 {
-  assert(log_file);
-
-  switch (width) {
-    case 8:
-      fprintf(log_file, "0x%01" PRIx8, (uint8_t)lo);
-      break;
-    case 16:
-      fprintf(log_file, "0x%04" PRIx16, (uint16_t)lo);
-      break;
-    case 32:
-      fprintf(log_file, "0x%08" PRIx32, (uint32_t)lo);
-      break;
-    case 64:
-      fprintf(log_file, "0x%016" PRIx64, lo);
-      break;
-    case 128:
-      fprintf(log_file, "0x%016" PRIx64 "%016" PRIx64, hi, lo);
-      break;
-    default:
-      abort();
+  if (p->get_commit_trace()) {
+    p->get_commit_trace()->record(p->get_commit_trace_index(), p, pc, insn);
+    return;
   }
-}
 
-static void commit_log_print_insn(processor_t *p, reg_t pc, insn_t insn)
-{
   FILE *log_file = p->get_log_file();
 
   auto& reg = p->get_state()->log_reg_write;
@@ -137,68 +108,51 @@ static void commit_log_print_insn(processor_t *p, reg_t pc, insn_t insn)
   }
   fprintf(log_file, "\n");
 }
-#else
-static void commit_log_reset(processor_t* p) {}
-static void commit_log_stash_privilege(processor_t* p) {}
-static void commit_log_print_insn(processor_t* p, reg_t pc, insn_t insn) {}
-#endif
-
-inline void processor_t::update_histogram(reg_t pc)
-{
-#ifdef RISCV_ENABLE_HISTOGRAM
-  pc_histogram[pc]++;
-#endif
-}
 
 // This is expected to be inlined by the compiler so each use of execute_insn
 // includes a duplicated body of the function to get separate fetch.func
-// function calls.
+// function calls. Commit logging is only done on the slow path, so the fast
+// path uses the variant without it.
+template<bool log_commits>
 static reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
 {
+  if (!log_commits)
+    return fetch.func(p, fetch.insn, pc);
+
   commit_log_reset(p);
   commit_log_stash_privilege(p);
   reg_t npc;
 
   try {
     npc = fetch.func(p, fetch.insn, pc);
-    if (npc != PC_SERIALIZE_BEFORE) {
-
-#ifdef RISCV_ENABLE_COMMITLOG
-      if (p->get_log_commits_enabled()) {
-        commit_log_print_insn(p, pc, fetch.insn);
-      }
-#endif
-
-     }
-#ifdef RISCV_ENABLE_COMMITLOG
+    if (npc != PC_SERIALIZE_BEFORE)
+      commit_log_print_insn(p, pc, fetch.insn);
   } catch(mem_trap_t& t) {
       //handle segfault in midlle of vector load/store
-      if (p->get_log_commits_enabled()) {
-        for (auto item : p->get_state()->log_reg_write) {
-          if ((item.first & 3) == 3) {
-            commit_log_print_insn(p, pc, fetch.insn);
-            break;
-          }
+      for (auto item : p->get_state()->log_reg_write) {
+        if ((item.first & 3) == 3) {
+          commit_log_print_insn(p, pc, fetch.insn);
+          break;
         }
       }
       throw;
-#endif
-  } catch(...) {
-    throw;
   }
-  p->update_histogram(pc);
-
   return npc;
 }
 
 bool processor_t::slow_path()
 {
-  return debug || state.single_step != state.STEP_NONE || state.debug_mode;
+  return debug || state.single_step != state.STEP_NONE || state.debug_mode ||
+         log_commits_enabled;
 }
 
 // fetch/decode/execute loop
-void processor_t::step(size_t n)
+size_t processor_t::step(size_t n)
 {
+  const size_t requested = n;
+  size_t ran = 0;
+  bool stopped = false;
+
   if (!state.debug_mode) {
     if (halt_request == HR_REGULAR) {
       enter_debug_mode(DCSR_CAUSE_DEBUGINT);
@@ -211,10 +165,36 @@ void processor_t::step(size_t n)
   }
 
   while (n > 0) {
+    // end the step at the instruction count that opens or closes a logging
+    // window, as a trap would
+    if (unlikely(log_trigger.type == log_trigger_t::INSTRET)) {
+      if (state.minstret >= log_trigger.value)
+        toggle_log_window();
+      if (log_trigger.type == log_trigger_t::INSTRET)
+        n = std::min<reg_t>(n, log_trigger.value - state.minstret);
+    }
+
     size_t instret = 0;
     reg_t pc = state.pc;
     mmu_t* _mmu = mmu;
 
+    // the fast path's current block, whose instructions are counted once
+    // it ends or, if it is cut short by a trap, in the handler below (which
+    // also counts an instruction that is rerun there as extra)
+    insn_block_t* block = NULL;
+    reg_t block_pc = 0;
+    size_t block_start = 0;
+    auto retire_partial_block = [&](size_t extra) {
+      size_t insns = instret - block_start + extra;
+      if (unlikely(profiler != NULL))
+        *block->prof_count += insns;
+      if (unlikely(callgraph != NULL))
+        callgraph->retire(insns);
+      if (unlikely(bbv != NULL) && insns)
+        bbv->add(block_pc, &block->bbv_count, insns, -1);
+      block = NULL;
+    };
+
     #define advance_pc() \
      if (unlikely(invalid_pc(pc))) { \
        switch (pc) { \
@@ -238,6 +218,16 @@ void processor_t::step(size_t n)
       {
         while (instret < n)
         {
+          if (unlikely(pc == log_trigger_pc)) {
+            toggle_log_window();
+            break;
+          }
+          if (unlikely(stop_condition != nullptr) && stop_condition()) {
+            n = instret;
+            stopped = true;
+            break;
+          }
+
           if (unlikely(!state.serialized && state.single_step == state.STEP_STEPPED)) {
             state.single_step = state.STEP_NONE;
             if (!state.debug_mode) {
@@ -254,62 +244,123 @@ void processor_t::step(size_t n)
           insn_fetch_t fetch = mmu->load_insn(pc);
           if (debug && !state.serialized)
             disasm(fetch.insn);
-          pc = execute_insn(this, pc, fetch);
+          reg_t insn_pc = pc;
+          if (unlikely(callgraph != NULL))
+            callgraph->enter(state.prv, state.satp);
+          pc = log_commits_enabled ? execute_insn<true>(this, pc, fetch)
+                                   : execute_insn<false>(this, pc, fetch);
+          if (unlikely(profiler != NULL))
+            profiler->add(insn_pc, 1);
+          if (unlikely(callgraph != NULL))
+            callgraph->retire(fetch.insn, 1, pc, &state.XPR[0]);
+          if (unlikely(bbv != NULL)) {
+            uint64_t* bbv_count = NULL;
+            reg_t next_pc = insn_pc + fetch.insn.length();
+            bbv->add(insn_pc, &bbv_count, 1, pc == next_pc ? pc : -1);
+          }
           advance_pc();
         }
       }
       else while (instret < n)
       {
-        // This code uses a modified Duff's Device to improve the performance
-        // of executing instructions. While typical Duff's Devices are used
-        // for software pipelining, the switch statement below primarily
-        // benefits from separate call points for the fetch.func function call
-        // found in each execute_insn. This function call is an indirect jump
-        // that depends on the current instruction. By having an indirect jump
-        // dedicated for each icache entry, you improve the performance of the
-        // host's next address predictor. Each case in the switch statement
-        // allows for the program flow to contine to the next case if it
-        // corresponds to the next instruction in the program and instret is
-        // still less than n.
-        //
-        // According to Andrew Waterman's recollection, this optimization
-        // resulted in approximately a 2x performance increase.
-
-        // This figures out where to jump to in the switch statement
-        size_t idx = _mmu->icache_index(pc);
-
-        // This gets the cached decoded instruction from the MMU. If the MMU
-        // does not have the current pc cached, it will refill the MMU and
-        // return the correct entry. ic_entry->data.func is the C++ function
-        // corresponding to the instruction.
-        auto ic_entry = _mmu->access_icache(pc);
-
-        // This macro is included in "icache.h" included within the switch
-        // statement below. The indirect jump corresponding to the instruction
-        // is located within the execute_insn() function call.
-        #define ICACHE_ACCESS(i) { \
-          insn_fetch_t fetch = ic_entry->data; \
-          pc = execute_insn(this, pc, fetch); \
-          ic_entry = ic_entry->next; \
-          if (i == mmu_t::ICACHE_ENTRIES-1) break; \
-          if (unlikely(ic_entry->tag != pc)) break; \
+        // Main simulation loop, fast path. Each basic block is fetched and
+        // decoded once, after which its instructions are executed back to
+        // back until one of them doesn't fall through to the next.
+        if (unlikely(pc == log_trigger_pc)) {
+          // switching logging may leave the fast path
+          toggle_log_window();
+          break;
+        }
+        if (unlikely(stop_condition != nullptr) && stop_condition()) {
+          n = instret;
+          stopped = true;
+          break;
+        }
+        block = _mmu->access_block(pc);
+        block_pc = pc;
+        block_start = instret;
+        if (unlikely(profiler != NULL) && !block->prof_count)
+          block->prof_count = profiler->counter(pc);
+        if (unlikely(callgraph != NULL))
+          callgraph->enter(state.prv, state.satp);
+
+        // The block is unrolled so that each position in it has its own
+        // indirect call to fetch.func (inside execute_insn), which helps the
+        // host's branch target predictor much like the Duff's device over
+        // the instruction cache that this replaces.
+        #define BLOCK_ACCESS(i) { \
+          insn_fetch_t fetch = block->insns[i]; \
+          next_pc = pc + fetch.insn.length(); \
+          pc = execute_insn<false>(this, pc, fetch); \
+          if (i == insn_block_t::MAX_INSNS-1) break; \
+          if (i+1 == block->length) break; \
+          if (unlikely(pc != next_pc)) break; \
           if (unlikely(instret+1 == n)) break; \
           instret++; \
           state.pc = pc; \
         }
 
-        // This switch statement implements the modified Duff's device as
-        // explained above.
-        switch (idx) {
-          // "icache.h" is generated by the gen_icache script
-          #include "icache.h"
-        }
-
+        static_assert(insn_block_t::MAX_INSNS == 16, "unrolling must match MAX_INSNS");
+        reg_t next_pc; // where the last instruction run would fall through to
+        if (unlikely(block->jit != NULL)) {
+          // Runs of instructions in this block have been translated to host
+          // code (see jit.h), which returns to the interpreter at the end of
+          // the block or at any instruction that needs the slow path.
+          jit_block_t* jit = block->jit;
+          reg_t* xpr = const_cast<reg_t*>(&state.XPR[0]);
+          for (size_t i = 0; ; ) {
+            size_t length = jit->length[i];
+            if (length && instret + length < n) {
+              reg_t npc;
+              size_t next = jit->func[i](xpr, &npc);
+              if (next == block->length) {
+                instret += next - i - 1;
+                next_pc = block_pc + jit->offset[next - 1] +
+                          block->insns[next - 1].insn.length();
+                pc = npc;
+                break;
+              }
+              instret += next - i;
+              i = next;
+              pc = block_pc + jit->offset[i];
+              state.pc = pc;
+            }
+            insn_fetch_t fetch = block->insns[i];
+            next_pc = pc + fetch.insn.length();
+            pc = execute_insn<false>(this, pc, fetch);
+            if (++i == block->length) break;
+            if (unlikely(pc != next_pc)) break;
+            if (unlikely(instret+1 == n)) break;
+            instret++;
+            state.pc = pc;
+          }
+        } else do {
+          BLOCK_ACCESS(0) BLOCK_ACCESS(1) BLOCK_ACCESS(2) BLOCK_ACCESS(3)
+          BLOCK_ACCESS(4) BLOCK_ACCESS(5) BLOCK_ACCESS(6) BLOCK_ACCESS(7)
+          BLOCK_ACCESS(8) BLOCK_ACCESS(9) BLOCK_ACCESS(10) BLOCK_ACCESS(11)
+          BLOCK_ACCESS(12) BLOCK_ACCESS(13) BLOCK_ACCESS(14) BLOCK_ACCESS(15)
+        } while (0);
+        #undef BLOCK_ACCESS
+
+        // the last instruction is counted by advance_pc()
+        if (unlikely(bbv != NULL))
+          bbv->add(block_pc, &block->bbv_count, instret - block_start + 1,
+                   pc == next_pc ? pc : -1);
+        if (unlikely(profiler != NULL))
+          *block->prof_count += instret - block_start + 1;
+        if (unlikely(callgraph != NULL))
+          callgraph->retire(block->insns[instret - block_start].insn,
+                            instret - block_start + 1, pc, &state.XPR[0]);
+        block = NULL;
         advance_pc();
       }
     }
     catch(trap_t& t)
     {
+      if (block)
+        retire_partial_block(0);
+      if (unlikely(bbv != NULL))
+        bbv->end_block();
       take_trap(t, pc);
       n = instret;
 
@@ -320,6 +371,10 @@ void processor_t::step(size_t n)
     }
     catch (trigger_matched_t& t)
     {
+      if (block)
+        retire_partial_block(mmu->matched_trigger ? 1 : 0);
+      if (unlikely(bbv != NULL))
+        bbv->end_block();
       if (mmu->matched_trigger) {
         // This exception came from the MMU. That means the instruction hasn't
         // fully executed yet. We start it again, but this time it won't throw
@@ -327,7 +382,8 @@ void processor_t::step(size_t n)
         // instructions are idempotent so restarting is safe.)
 
         insn_fetch_t fetch = mmu->load_insn(pc);
-        pc = execute_insn(this, pc, fetch);
+        pc = log_commits_enabled ? execute_insn<true>(this, pc, fetch)
+                                 : execute_insn<false>(this, pc, fetch);
         advance_pc();
 
         delete mmu->matched_trigger;
@@ -354,10 +410,18 @@ void processor_t::step(size_t n)
       // In the debug ROM this prevents us from wasting time looping, but also
       // allows us to switch to other threads only once per idle loop in case
       // there is activity.
+      if (block)
+        retire_partial_block(0);
+      if (unlikely(bbv != NULL))
+        bbv->end_block();
       n = instret;
     }
 
     state.minstret += instret;
+    ran += instret;
     n -= instret;
   }
+
+  // WFI also ends the step early, but idles away the rest of it
+  return stopped ? ran : requested;
 }
@@ -0,0 +1,197 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_HOST_FP_H
+#define _RISCV_HOST_FP_H
+
+#include "softfloat.h"
+#include <string.h>
+
+// Single- and double-precision add, subtract, multiply and divide on the
+// host FPU, for --host-fp. The host's IEEE arithmetic gives softfloat's
+// results and flags when rounding to nearest-even, except that NaNs aren't
+// canonicalized, and tininess and denormals may be handled differently, so
+// those cases are left to softfloat.
+//
+// Runs of vector operations read the host's flags from the SSE
+// control/status register, which is set to its default (round to
+// nearest-even, all exceptions masked, no flushing of denormals) before
+// each run; a run is redone in softfloat if it produces a NaN, or the host
+// raises invalid, underflow or denormal-operand. Scalar operations can't
+// afford the register, so they check exactness instead (see below).
+// Elsewhere, the softfloat routines are used as they are.
+
+#if defined(__SSE2_MATH__) && !defined(__FAST_MATH__)
+#define HOST_FP_SUPPORTED 1
+#include <xmmintrin.h>
+#include <float.h>
+#include <math.h>
+
+const unsigned HOST_FP_MXCSR = 0x1f80;
+const unsigned HOST_FP_INVALID = 0x01;
+const unsigned HOST_FP_DENORMAL = 0x02;
+const unsigned HOST_FP_DIVBYZERO = 0x04;
+const unsigned HOST_FP_OVERFLOW = 0x08;
+const unsigned HOST_FP_UNDERFLOW = 0x10;
+const unsigned HOST_FP_INEXACT = 0x20;
+const unsigned HOST_FP_REDO = HOST_FP_INVALID | HOST_FP_DENORMAL | HOST_FP_UNDERFLOW;
+
+static inline void host_fp_begin()
+{
+  _mm_setcsr(HOST_FP_MXCSR);
+  asm volatile("" ::: "memory");
+}
+
+// the flags raised since host_fp_begin by operations whose results were
+// stored to the local array at out, which the barrier makes the compiler
+// finish first
+static inline unsigned host_fp_end(const void* out)
+{
+  asm volatile("" :: "r"(out) : "memory");
+  return _mm_getcsr() & 0x3f;
+}
+
+static inline uint_fast8_t host_fp_softfloat_flags(unsigned flags)
+{
+  return (flags & HOST_FP_INEXACT ? softfloat_flag_inexact : 0) |
+         (flags & HOST_FP_OVERFLOW ? softfloat_flag_overflow : 0) |
+         (flags & HOST_FP_DIVBYZERO ? softfloat_flag_infinite : 0);
+}
+
+static inline float host_fp(float32_t x) { float h; memcpy(&h, &x, sizeof(h)); return h; }
+static inline double host_fp(float64_t x) { double h; memcpy(&h, &x, sizeof(h)); return h; }
+static inline float32_t softfloat_fp(float h) { float32_t x; memcpy(&x, &h, sizeof(x)); return x; }
+static inline float64_t softfloat_fp(double h) { float64_t x; memcpy(&x, &h, sizeof(x)); return x; }
+
+// Scalar operations are too short to pay for writing and reading the
+// control/status register. They find inexact by computing their rounding
+// error exactly, and leave to softfloat any result that isn't a normal
+// number (or operands beyond the range where the error is exact), since
+// only then can other flags arise. The host rounds to nearest-even.
+static inline bool host_fp_normal(float x) { return fabsf(x) > FLT_MIN && fabsf(x) <= FLT_MAX; }
+static inline bool host_fp_normal(double x) { return fabs(x) > DBL_MIN && fabs(x) <= DBL_MAX; }
+
+// within 2^-485 and 2^485, where the product of two is exactly the sum of
+// two doubles
+static inline bool host_fp_moderate(double x) { return fabs(x) > 1e-145 && fabs(x) < 1e145; }
+
+// whether r = x + y exactly (Knuth's two-sum)
+template<class H> static inline bool host_fp_exact_sum(H x, H y, H r)
+{
+  H yy = r - x;
+  return (x - (r - yy)) + (y - yy) == 0;
+}
+
+// whether r = x * y exactly, given r is x * y rounded (Dekker's product)
+static inline bool host_fp_exact_product(double x, double y, double r)
+{
+#ifdef __FP_FAST_FMA
+  return __builtin_fma(x, y, -r) == 0;
+#else
+  const double split = 134217729.0; // 2^27 + 1
+  double cx = split * x, xh = cx - (cx - x), xl = x - xh;
+  double cy = split * y, yh = cy - (cy - y), yl = y - yh;
+  return (((xh * yh - r) + xh * yl) + xl * yh) + xl * yl == 0;
+#endif
+}
+
+static inline void host_fp_inexact(bool exact)
+{
+  if (!exact)
+    softfloat_exceptionFlags |= softfloat_flag_inexact;
+}
+
+static inline float32_t host_f32_add(float32_t a, float32_t b)
+{
+  float x = host_fp(a), y = host_fp(b), r = x + y;
+  if (softfloat_roundingMode != softfloat_round_near_even || !host_fp_normal(r))
+    return f32_add(a, b);
+  host_fp_inexact(host_fp_exact_sum(x, y, r));
+  return softfloat_fp(r);
+}
+
+static inline float32_t host_f32_sub(float32_t a, float32_t b)
+{
+  float x = host_fp(a), y = -host_fp(b), r = x + y;
+  if (softfloat_roundingMode != softfloat_round_near_even || !host_fp_normal(r))
+    return f32_sub(a, b);
+  host_fp_inexact(host_fp_exact_sum(x, y, r));
+  return softfloat_fp(r);
+}
+
+// Single-precision products and quotients are computed in double and
+// rounded once more, which gives the correctly rounded result since double
+// has more than twice the precision; the product of two floats is exact in
+// double.
+static inline float32_t host_f32_mul(float32_t a, float32_t b)
+{
+  double d = (double)host_fp(a) * host_fp(b);
+  float r = d;
+  if (softfloat_roundingMode != softfloat_round_near_even || !host_fp_normal(r))
+    return f32_mul(a, b);
+  host_fp_inexact(r == d);
+  return softfloat_fp(r);
+}
+
+static inline float32_t host_f32_div(float32_t a, float32_t b)
+{
+  double x = host_fp(a), y = host_fp(b);
+  float r = x / y;
+  if (softfloat_roundingMode != softfloat_round_near_even || !host_fp_normal(r))
+    return f32_div(a, b);
+  host_fp_inexact(r * y == x);
+  return softfloat_fp(r);
+}
+
+static inline float64_t host_f64_add(float64_t a, float64_t b)
+{
+  double x = host_fp(a), y = host_fp(b), r = x + y;
+  if (softfloat_roundingMode != softfloat_round_near_even || !host_fp_normal(r))
+    return f64_add(a, b);
+  host_fp_inexact(host_fp_exact_sum(x, y, r));
+  return softfloat_fp(r);
+}
+
+static inline float64_t host_f64_sub(float64_t a, float64_t b)
+{
+  double x = host_fp(a), y = -host_fp(b), r = x + y;
+  if (softfloat_roundingMode != softfloat_round_near_even || !host_fp_normal(r))
+    return f64_sub(a, b);
+  host_fp_inexact(host_fp_exact_sum(x, y, r));
+  return softfloat_fp(r);
+}
+
+static inline float64_t host_f64_mul(float64_t a, float64_t b)
+{
+  double x = host_fp(a), y = host_fp(b), r = x * y;
+  if (softfloat_roundingMode != softfloat_round_near_even ||
+      !host_fp_moderate(x) || !host_fp_moderate(y))
+    return f64_mul(a, b);
+  host_fp_inexact(host_fp_exact_product(x, y, r));
+  return softfloat_fp(r);
+}
+
+static inline float64_t host_f64_div(float64_t a, float64_t b)
+{
+  double x = host_fp(a), y = host_fp(b), r = x / y;
+  if (softfloat_roundingMode != softfloat_round_near_even ||
+      !host_fp_moderate(x) || !host_fp_moderate(y) || !host_fp_moderate(r))
+    return f64_div(a, b);
+  double p = r * y;
+  host_fp_inexact(p == x && host_fp_exact_product(r, y, p));
+  return softfloat_fp(r);
+}
+
+#else
+
+#define HOST_FP_FUNC(name) \
+  static inline float32_t host_f32_##name(float32_t a, float32_t b) { return f32_##name(a, b); } \
+  static inline float64_t host_f64_##name(float64_t a, float64_t b) { return f64_##name(a, b); }
+
+HOST_FP_FUNC(add)
+HOST_FP_FUNC(sub)
+HOST_FP_FUNC(mul)
+HOST_FP_FUNC(div)
+
+#endif
+
+#endif
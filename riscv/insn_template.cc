@@ -2,20 +2,34 @@
 
 #include "insn_template.h"
 
-reg_t rv32_NAME(processor_t* p, insn_t insn, reg_t pc)
+#undef LOG_COMMITS
+#define LOG_COMMITS log_commits
+
+template<int xlen, bool log_commits>
+static inline reg_t execute_NAME(processor_t* p, insn_t insn, reg_t pc)
 {
-  int xlen = 32;
   reg_t npc = sext_xlen(pc + insn_length(OPCODE));
   #include "insns/NAME.h"
   trace_opcode(p, OPCODE, insn);
   return npc;
 }
 
+reg_t rv32_NAME(processor_t* p, insn_t insn, reg_t pc)
+{
+  return execute_NAME<32, false>(p, insn, pc);
+}
+
 reg_t rv64_NAME(processor_t* p, insn_t insn, reg_t pc)
 {
-  int xlen = 64;
-  reg_t npc = sext_xlen(pc + insn_length(OPCODE));
-  #include "insns/NAME.h"
-  trace_opcode(p, OPCODE, insn);
-  return npc;
+  return execute_NAME<64, false>(p, insn, pc);
+}
+
+reg_t logged_rv32_NAME(processor_t* p, insn_t insn, reg_t pc)
+{
+  return execute_NAME<32, true>(p, insn, pc);
+}
+
+reg_t logged_rv64_NAME(processor_t* p, insn_t insn, reg_t pc)
+{
+  return execute_NAME<64, true>(p, insn, pc);
 }
@@ -1,5 +1,5 @@
 int csr = validate_csr(insn.csr(), true);
 reg_t old = p->get_csr(csr);
-p->set_csr(csr, insn.rs1());
+p->set_csr_from_insn(csr, insn.rs1());
 WRITE_RD(sext_xlen(old));
 serialize();
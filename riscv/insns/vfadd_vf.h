@@ -1,5 +1,5 @@
 // vfadd.vf vd, vs2, rs1
-VI_VFP_VF_LOOP
+VI_VFP_VF_LOOP_HOST
 ({
   vd = f16_add(rs1, vs2);
 },
@@ -8,4 +8,5 @@ VI_VFP_VF_LOOP
 },
 {
   vd = f64_add(rs1, vs2);
-})
+},
+rs1 + vs2)
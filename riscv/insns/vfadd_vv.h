@@ -1,5 +1,5 @@
 // vfadd.vv vd, vs2, vs1
-VI_VFP_VV_LOOP
+VI_VFP_VV_LOOP_HOST
 ({
   vd = f16_add(vs1, vs2);
 },
@@ -8,4 +8,5 @@ VI_VFP_VV_LOOP
 },
 {
   vd = f64_add(vs1, vs2);
-})
+},
+vs1 + vs2)
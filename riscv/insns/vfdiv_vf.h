@@ -1,5 +1,5 @@
 // vfdiv.vf vd, vs2, rs1
-VI_VFP_VF_LOOP
+VI_VFP_VF_LOOP_HOST
 ({
   vd = f16_div(vs2, rs1);
 },
@@ -8,4 +8,5 @@ VI_VFP_VF_LOOP
 },
 {
   vd = f64_div(vs2, rs1);
-})
+},
+vs2 / rs1)
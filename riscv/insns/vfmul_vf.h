@@ -1,5 +1,5 @@
 // vfmul.vf vd, vs2, rs1, vm
-VI_VFP_VF_LOOP
+VI_VFP_VF_LOOP_HOST
 ({
   vd = f16_mul(vs2, rs1);
 },
@@ -8,4 +8,5 @@ VI_VFP_VF_LOOP
 },
 {
   vd = f64_mul(vs2, rs1);
-})
+},
+vs2 * rs1)
@@ -1,5 +1,5 @@
 // vfmul.vv vd, vs1, vs2, vm
-VI_VFP_VV_LOOP
+VI_VFP_VV_LOOP_HOST
 ({
   vd = f16_mul(vs1, vs2);
 },
@@ -8,4 +8,5 @@ VI_VFP_VV_LOOP
 },
 {
   vd = f64_mul(vs1, vs2);
-})
+},
+vs1 * vs2)
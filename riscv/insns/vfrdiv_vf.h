@@ -1,5 +1,5 @@
 // vfrdiv.vf vd, vs2, rs1, vm  # scalar-vector, vd[i] = f[rs1]/vs2[i]
-VI_VFP_VF_LOOP
+VI_VFP_VF_LOOP_HOST
 ({
   vd = f16_div(rs1, vs2);
 },
@@ -8,4 +8,5 @@ VI_VFP_VF_LOOP
 },
 {
   vd = f64_div(rs1, vs2);
-})
+},
+rs1 / vs2)
@@ -1,2 +1,2 @@
 // vle16.v and vlseg[2-8]e16.v
-VI_LD(0, (i * nf + fn), int16);
+VI_LD_UNIT_STRIDE(int16);
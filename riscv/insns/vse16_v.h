@@ -1,2 +1,2 @@
 // vse16.v and vsseg[2-8]e16.v
-VI_ST(0, (i * nf + fn), uint16);
+VI_ST_UNIT_STRIDE(uint16);
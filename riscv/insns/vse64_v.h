@@ -1,2 +1,2 @@
 // vse64.v and vsseg[2-8]e64.v
-VI_ST(0, (i * nf + fn), uint64);
+VI_ST_UNIT_STRIDE(uint64);
@@ -139,6 +139,8 @@ void sim_t::interactive_help(const std::string& cmd, const std::vector<std::stri
     "help                            # This screen!\n"
     "h                                 Alias for help\n"
     "Note: Hitting enter is the same as: run 1\n"
+    "Note: until and while check reg and mem between basic blocks, so they\n"
+    "      can stop a few instructions late (pc conditions and untiln are exact)\n"
     << std::flush;
 }
 
@@ -157,8 +159,10 @@ void sim_t::interactive_run(const std::string& cmd, const std::vector<std::strin
   size_t steps = args.size() ? atoll(args[0].c_str()) : -1;
   ctrlc_pressed = false;
   set_procs_debug(noisy);
-  for (size_t i = 0; i < steps && !ctrlc_pressed && !done(); i++)
-    step(1);
+  for (size_t i = 0, n; i < steps && !ctrlc_pressed && !done(); i += n) {
+    n = std::min(steps - i, size_t(INTERLEAVE));
+    step(n);
+  }
 }
 
 void sim_t::interactive_quit(const std::string& cmd, const std::vector<std::string>& args)
@@ -398,22 +402,42 @@ void sim_t::interactive_until(const std::string& cmd, const std::vector<std::str
   if (func == NULL)
     return;
 
-  ctrlc_pressed = false;
-
-  while (1)
-  {
-    try
-    {
-      reg_t current = (this->*func)(args2);
+  // Memory is polled through the debug MMU, which has no caches or tracers
+  // to disturb; a core's virtual address is translated once, up front.
+  if (args[0] == "mem" && args2.size() == 2) {
+    reg_t addr = strtol(args2[1].c_str(),NULL,16);
+    if (addr == LONG_MAX)
+      addr = strtoul(args2[1].c_str(),NULL,16);
+    try {
+      addr = get_core(args2[0])->get_mmu()->translate_load(addr);
+    } catch (trap_t& t) {
+      return;
+    }
+    char buf[17];
+    snprintf(buf, sizeof buf, "%" PRIx64, addr);
+    args2 = {buf};
+  }
 
-      if (cmd_until == (current == val))
-        break;
-      if (ctrlc_pressed)
-        break;
+  auto met = [&]() {
+    try {
+      return cmd_until == ((this->*func)(args2) == val);
+    } catch (trap_t& t) {
+      return false;
     }
-    catch (trap_t& t) {}
+  };
 
-    set_procs_debug(noisy);
-    step(1);
-  }
+  // Rather than stepping one instruction at a time, let the processors
+  // check the condition between basic blocks, stopping as soon as it holds.
+  // The PC run to or past runs as a block of its own, so that is exact.
+  reg_t stop_pc = args[0] == "pc" ? val : -1;
+  for (processor_t* p : procs)
+    p->set_stop_condition(met, stop_pc);
+
+  ctrlc_pressed = false;
+  set_procs_debug(noisy);
+  while (!met() && !ctrlc_pressed && !done())
+    step(INTERLEAVE - current_step); // the rest of this processor's turn
+
+  for (processor_t* p : procs)
+    p->set_stop_condition(nullptr);
 }
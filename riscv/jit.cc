@@ -0,0 +1,605 @@
+// See LICENSE for license details.
+
+#include "jit.h"
+#include "mmu.h"
+#include "processor.h"
+#include <sys/mman.h>
+#include <string.h>
+#include <vector>
+
+#define DECLARE_RV64_INSN(name) \
+  extern reg_t rv64_##name(processor_t*, insn_t, reg_t);
+DECLARE_RV64_INSN(add)
+DECLARE_RV64_INSN(sub)
+DECLARE_RV64_INSN(and)
+DECLARE_RV64_INSN(or)
+DECLARE_RV64_INSN(xor)
+DECLARE_RV64_INSN(sll)
+DECLARE_RV64_INSN(srl)
+DECLARE_RV64_INSN(sra)
+DECLARE_RV64_INSN(slt)
+DECLARE_RV64_INSN(sltu)
+DECLARE_RV64_INSN(addi)
+DECLARE_RV64_INSN(andi)
+DECLARE_RV64_INSN(ori)
+DECLARE_RV64_INSN(xori)
+DECLARE_RV64_INSN(slti)
+DECLARE_RV64_INSN(sltiu)
+DECLARE_RV64_INSN(slli)
+DECLARE_RV64_INSN(srli)
+DECLARE_RV64_INSN(srai)
+DECLARE_RV64_INSN(lui)
+DECLARE_RV64_INSN(auipc)
+DECLARE_RV64_INSN(addw)
+DECLARE_RV64_INSN(subw)
+DECLARE_RV64_INSN(sllw)
+DECLARE_RV64_INSN(srlw)
+DECLARE_RV64_INSN(sraw)
+DECLARE_RV64_INSN(addiw)
+DECLARE_RV64_INSN(slliw)
+DECLARE_RV64_INSN(srliw)
+DECLARE_RV64_INSN(sraiw)
+DECLARE_RV64_INSN(lb)
+DECLARE_RV64_INSN(lh)
+DECLARE_RV64_INSN(lw)
+DECLARE_RV64_INSN(ld)
+DECLARE_RV64_INSN(lbu)
+DECLARE_RV64_INSN(lhu)
+DECLARE_RV64_INSN(lwu)
+DECLARE_RV64_INSN(sb)
+DECLARE_RV64_INSN(sh)
+DECLARE_RV64_INSN(sw)
+DECLARE_RV64_INSN(sd)
+DECLARE_RV64_INSN(beq)
+DECLARE_RV64_INSN(bne)
+DECLARE_RV64_INSN(blt)
+DECLARE_RV64_INSN(bge)
+DECLARE_RV64_INSN(bltu)
+DECLARE_RV64_INSN(bgeu)
+DECLARE_RV64_INSN(jal)
+DECLARE_RV64_INSN(jalr)
+DECLARE_RV64_INSN(mul)
+DECLARE_RV64_INSN(mulh)
+DECLARE_RV64_INSN(mulhu)
+DECLARE_RV64_INSN(mulw)
+DECLARE_RV64_INSN(c_addi)
+DECLARE_RV64_INSN(c_addi4spn)
+DECLARE_RV64_INSN(c_li)
+DECLARE_RV64_INSN(c_lui)
+DECLARE_RV64_INSN(c_mv)
+DECLARE_RV64_INSN(c_add)
+DECLARE_RV64_INSN(c_jal)
+DECLARE_RV64_INSN(c_slli)
+DECLARE_RV64_INSN(c_srli)
+DECLARE_RV64_INSN(c_srai)
+DECLARE_RV64_INSN(c_andi)
+DECLARE_RV64_INSN(c_sub)
+DECLARE_RV64_INSN(c_xor)
+DECLARE_RV64_INSN(c_or)
+DECLARE_RV64_INSN(c_and)
+DECLARE_RV64_INSN(c_subw)
+DECLARE_RV64_INSN(c_addw)
+DECLARE_RV64_INSN(c_lw)
+DECLARE_RV64_INSN(c_sw)
+DECLARE_RV64_INSN(c_flw)
+DECLARE_RV64_INSN(c_fsw)
+DECLARE_RV64_INSN(c_lwsp)
+DECLARE_RV64_INSN(c_swsp)
+DECLARE_RV64_INSN(c_flwsp)
+DECLARE_RV64_INSN(c_fswsp)
+DECLARE_RV64_INSN(c_j)
+DECLARE_RV64_INSN(c_jr)
+DECLARE_RV64_INSN(c_jalr)
+DECLARE_RV64_INSN(c_beqz)
+DECLARE_RV64_INSN(c_bnez)
+#undef DECLARE_RV64_INSN
+
+jit_t::jit_t(processor_t* proc, mmu_t* mmu)
+  : proc(proc), mmu(mmu), code(NULL), used(0), is_full(false)
+{
+#if defined(__x86_64__)
+  void* p = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p != MAP_FAILED)
+    code = (uint8_t*)p;
+#endif
+}
+
+jit_t::~jit_t()
+{
+  if (code)
+    munmap(code, CODE_SIZE);
+}
+
+void jit_t::reset()
+{
+  used = 0;
+  is_full = false;
+}
+
+uint8_t* jit_t::alloc(size_t len)
+{
+  used = (used + 7) & ~size_t(7);
+  if (used + len > CODE_SIZE) {
+    is_full = true;
+    return NULL;
+  }
+  uint8_t* p = code + used;
+  used += len;
+  return p;
+}
+
+// A minimal x86-64 assembler. The generated code is called as
+// size_t f(reg_t* xpr, reg_t* npc), so %rdi points at the integer register
+// file, %rsi at the next PC, and %rax, %rcx, %rdx and %r8 are free to use.
+class x86_asm_t
+{
+public:
+  enum { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8 };
+  enum { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+  enum { SHL = 4, SHR = 5, SAR = 7 };
+  enum { CC_B = 2, CC_AE = 3, CC_E = 4, CC_NE = 5, CC_L = 0xc, CC_GE = 0xd };
+
+  std::vector<uint8_t> buf;
+
+  void byte(uint8_t x) { buf.push_back(x); }
+  void imm32(uint32_t x) { for (int i = 0; i < 4; i++) byte(x >> (8 * i)); }
+  void imm64(uint64_t x) { for (int i = 0; i < 8; i++) byte(x >> (8 * i)); }
+  void append(const x86_asm_t& a) { buf.insert(buf.end(), a.buf.begin(), a.buf.end()); }
+
+  void rex(bool w, int reg, int rm)
+  {
+    uint8_t rex = 0x40 | w << 3 | (reg >> 3) << 2 | (rm >> 3);
+    if (rex != 0x40) byte(rex);
+  }
+  void opcode(uint16_t op)
+  {
+    if (op > 0xff) byte(op >> 8);
+    byte(op);
+  }
+
+  // <op> reg, [base + disp]; w selects 64-bit operands
+  void mem(bool w, uint16_t op, int reg, int base, int32_t disp)
+  {
+    rex(w, reg, base);
+    opcode(op);
+    if (disp == 0 && (base & 7) != 5) {
+      byte((reg & 7) << 3 | (base & 7));
+    } else if (disp == (int8_t)disp) {
+      byte(0x40 | (reg & 7) << 3 | (base & 7)); byte(disp);
+    } else {
+      byte(0x80 | (reg & 7) << 3 | (base & 7)); imm32(disp);
+    }
+  }
+  // <op> reg, rm
+  void rr(bool w, uint16_t op, int reg, int rm)
+  {
+    rex(w, reg, rm);
+    opcode(op);
+    byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+  }
+
+  void load(bool w, int reg, int xreg) { mem(w, 0x8b, reg, RDI, xreg * sizeof(reg_t)); }
+  void store(int reg, int xreg) { mem(true, 0x89, reg, RDI, xreg * sizeof(reg_t)); }
+
+  void alu_imm(bool w, int op, int rm, int32_t imm) { rr(w, 0x81, op, rm); imm32(imm); }
+  void shift_imm(bool w, int op, int rm, int imm) { rr(w, 0xc1, op, rm); byte(imm); }
+  void shift_cl(bool w, int op, int rm) { rr(w, 0xd3, op, rm); }
+  void movsxd(int reg) { rr(true, 0x63, reg, reg); }
+  void setcc(int cc) { rr(false, 0x0f90 | cc, 0, RAX); rr(false, 0x0fb6, RAX, RAX); }
+  void cmov(int cc, int dst, int src) { rr(true, 0x0f40 | cc, dst, src); }
+  void mov_imm(int reg, int64_t imm)
+  {
+    if (imm == (int32_t)imm) {
+      rr(true, 0xc7, 0, reg); imm32(imm);
+    } else {
+      rex(true, 0, reg); byte(0xb8 | (reg & 7)); imm64(imm);
+    }
+  }
+
+  // return idx, the index of the next instruction to execute
+  void exit(size_t idx) { byte(0xb8); imm32(idx); byte(0xc3); }
+  static const int EXIT_SIZE = 6;
+  // exit(idx) unless condition code cc holds
+  void exit_unless(int cc, size_t idx) { byte(0x70 | cc); byte(EXIT_SIZE); exit(idx); }
+};
+
+typedef x86_asm_t X;
+
+static uint16_t alu_opcode(int op)
+{
+  switch (op) {
+    case X::ADD: return 0x03;
+    case X::OR: return 0x0b;
+    case X::AND: return 0x23;
+    case X::SUB: return 0x2b;
+    case X::XOR: return 0x33;
+    default: return 0x3b;
+  }
+}
+
+// writes to x0 have no effect, so the helpers below don't emit them
+
+static void alu_rr(X& a, bool w, int op, int rd, int rs1, int rs2)
+{
+  if (rd == 0)
+    return;
+  a.load(w, X::RAX, rs1);
+  a.mem(w, alu_opcode(op), X::RAX, X::RDI, rs2 * sizeof(reg_t));
+  if (!w) a.movsxd(X::RAX);
+  a.store(X::RAX, rd);
+}
+
+static void alu_ri(X& a, bool w, int op, int rd, int rs1, int32_t imm)
+{
+  if (rd == 0)
+    return;
+  a.load(w, X::RAX, rs1);
+  a.alu_imm(w, op, X::RAX, imm);
+  if (!w) a.movsxd(X::RAX);
+  a.store(X::RAX, rd);
+}
+
+static void shift_rr(X& a, bool w, int op, int rd, int rs1, int rs2)
+{
+  if (rd == 0)
+    return;
+  a.load(w, X::RAX, rs1);
+  a.load(w, X::RCX, rs2);
+  a.shift_cl(w, op, X::RAX);
+  if (!w) a.movsxd(X::RAX);
+  a.store(X::RAX, rd);
+}
+
+static void shift_ri(X& a, bool w, int op, int rd, int rs1, int shamt)
+{
+  if (rd == 0)
+    return;
+  a.load(w, X::RAX, rs1);
+  a.shift_imm(w, op, X::RAX, shamt);
+  if (!w) a.movsxd(X::RAX);
+  a.store(X::RAX, rd);
+}
+
+static void set_rr(X& a, int cc, int rd, int rs1, int rs2)
+{
+  if (rd == 0)
+    return;
+  a.load(true, X::RAX, rs1);
+  a.mem(true, alu_opcode(X::CMP), X::RAX, X::RDI, rs2 * sizeof(reg_t));
+  a.setcc(cc);
+  a.store(X::RAX, rd);
+}
+
+static void set_ri(X& a, int cc, int rd, int rs1, int32_t imm)
+{
+  if (rd == 0)
+    return;
+  a.load(true, X::RAX, rs1);
+  a.alu_imm(true, X::CMP, X::RAX, imm);
+  a.setcc(cc);
+  a.store(X::RAX, rd);
+}
+
+static void li(X& a, int rd, int64_t imm)
+{
+  if (rd == 0)
+    return;
+  a.mov_imm(X::RAX, imm);
+  a.store(X::RAX, rd);
+}
+
+static void mul(X& a, bool w, int rd, int rs1, int rs2)
+{
+  if (rd == 0)
+    return;
+  a.load(w, X::RAX, rs1);
+  a.mem(w, 0x0faf, X::RAX, X::RDI, rs2 * sizeof(reg_t)); // imul
+  if (!w) a.movsxd(X::RAX);
+  a.store(X::RAX, rd);
+}
+
+static void mulh(X& a, bool is_signed, int rd, int rs1, int rs2)
+{
+  if (rd == 0)
+    return;
+  a.load(true, X::RAX, rs1);
+  // imul/mul into rdx:rax
+  a.mem(true, 0xf7, is_signed ? 5 : 4, X::RDI, rs2 * sizeof(reg_t));
+  a.store(X::RDX, rd);
+}
+
+// Translate the virtual address in %rax to a host address in %rcx using the
+// TLB, like the fast paths of mmu_t::load_func and store_func. Misaligned
+// accesses and TLB misses (including entries that must check triggers) exit
+// to the interpreter, which retries the instruction the slow way.
+static void tlb_lookup(X& a, const reg_t* tags, const tlb_entry_t* data,
+                       size_t size, size_t tlb_entries, size_t idx)
+{
+  static_assert(sizeof(tlb_entry_t) == 16, "tlb_entry_t layout");
+  if (size > 1) {
+    a.byte(0xa9); a.imm32(size - 1); // test eax, size-1
+    a.exit_unless(X::CC_E, idx);
+  }
+  a.rr(true, 0x8b, X::RCX, X::RAX);               // rcx = vpn
+  a.shift_imm(true, X::SHR, X::RCX, PGSHIFT);
+  a.rr(false, 0x8b, X::RDX, X::RCX);              // rdx = vpn % entries * 8
+  a.alu_imm(false, X::AND, X::RDX, tlb_entries - 1);
+  a.shift_imm(false, X::SHL, X::RDX, 3);
+  a.mov_imm(X::R8, (int64_t)tags);
+  a.rr(true, 0x03, X::R8, X::RDX);
+  a.mem(true, 0x3b, X::RCX, X::R8, 0);
+  a.exit_unless(X::CC_E, idx);
+  a.mov_imm(X::R8, (int64_t)data);
+  a.rr(true, 0x03, X::R8, X::RDX);
+  a.rr(true, 0x03, X::R8, X::RDX);
+  a.mem(true, 0x8b, X::RCX, X::R8, 0);            // host_offset
+  a.rr(true, 0x03, X::RCX, X::RAX);
+}
+
+// the next PC is written to *npc by control transfers
+static void set_npc_imm(X& a, reg_t npc)
+{
+  a.mov_imm(X::RAX, npc);
+  a.mem(true, 0x89, X::RAX, X::RSI, 0);
+}
+
+static void branch(X& a, int cc, int rs1, int rs2, reg_t target, reg_t next)
+{
+  a.load(true, X::RAX, rs1);
+  a.mem(true, alu_opcode(X::CMP), X::RAX, X::RDI, rs2 * sizeof(reg_t));
+  a.mov_imm(X::RCX, next);
+  a.mov_imm(X::RDX, target);
+  a.cmov(cc, X::RCX, X::RDX);
+  a.mem(true, 0x89, X::RCX, X::RSI, 0);
+}
+
+static void jump(X& a, int rd, reg_t target, reg_t link)
+{
+  li(a, rd, link);
+  set_npc_imm(a, target);
+}
+
+static void jump_reg(X& a, bool has_c, int rd, int rs1, int32_t imm,
+                     reg_t link, size_t idx)
+{
+  a.load(true, X::RAX, rs1);
+  a.alu_imm(true, X::ADD, X::RAX, imm);
+  a.alu_imm(true, X::AND, X::RAX, -2);
+  if (!has_c) {
+    a.byte(0xa9); a.imm32(2); // test eax, 2
+    a.exit_unless(X::CC_E, idx);
+  }
+  if (rd != 0) {
+    a.mov_imm(X::RCX, link);
+    a.store(X::RCX, rd);
+  }
+  a.mem(true, 0x89, X::RAX, X::RSI, 0);
+}
+
+jit_t::result_t jit_t::translate(x86_asm_t& a, insn_fetch_t fetch, reg_t pc,
+                                 size_t idx)
+{
+  insn_t insn = fetch.insn;
+  insn_func_t f = fetch.func;
+  int rd = insn.rd(), rs1 = insn.rs1(), rs2 = insn.rs2();
+  bool has_m = proc->supports_extension('M');
+  bool has_c = proc->supports_extension('C');
+  reg_t npc = pc + insn.length();
+
+  // static branch targets that would trap aren't translated
+  reg_t target = pc;
+  if (f == rv64_jal) target = pc + insn.uj_imm();
+  else if (f == rv64_beq || f == rv64_bne || f == rv64_blt || f == rv64_bge ||
+           f == rv64_bltu || f == rv64_bgeu) target = pc + insn.sb_imm();
+  if (!has_c && (target & 2))
+    return FAIL;
+
+  #define LOAD(w, op, rd, rs1, imm, size) ( \
+    a.load(true, X::RAX, rs1), \
+    a.alu_imm(true, X::ADD, X::RAX, imm), \
+    tlb_lookup(a, mmu->tlb_load_tag, mmu->tlb_data, size, mmu->TLB_ENTRIES, idx), \
+    a.mem(w, op, X::RAX, X::RCX, 0), \
+    (rd) ? a.store(X::RAX, rd) : (void)0)
+  #define STORE(prefix, w, op, rs2, rs1, imm, size) ( \
+    a.load(true, X::RAX, rs1), \
+    a.alu_imm(true, X::ADD, X::RAX, imm), \
+    tlb_lookup(a, mmu->tlb_store_tag, mmu->tlb_data, size, mmu->TLB_ENTRIES, idx), \
+    a.load(true, X::RDX, rs2), \
+    (prefix) ? a.byte(prefix) : (void)0, \
+    a.mem(w, op, X::RDX, X::RCX, 0))
+
+  // RV64I
+  if (f == rv64_add) alu_rr(a, true, X::ADD, rd, rs1, rs2);
+  else if (f == rv64_sub) alu_rr(a, true, X::SUB, rd, rs1, rs2);
+  else if (f == rv64_and) alu_rr(a, true, X::AND, rd, rs1, rs2);
+  else if (f == rv64_or) alu_rr(a, true, X::OR, rd, rs1, rs2);
+  else if (f == rv64_xor) alu_rr(a, true, X::XOR, rd, rs1, rs2);
+  else if (f == rv64_sll) shift_rr(a, true, X::SHL, rd, rs1, rs2);
+  else if (f == rv64_srl) shift_rr(a, true, X::SHR, rd, rs1, rs2);
+  else if (f == rv64_sra) shift_rr(a, true, X::SAR, rd, rs1, rs2);
+  else if (f == rv64_slt) set_rr(a, X::CC_L, rd, rs1, rs2);
+  else if (f == rv64_sltu) set_rr(a, X::CC_B, rd, rs1, rs2);
+  else if (f == rv64_addi) alu_ri(a, true, X::ADD, rd, rs1, insn.i_imm());
+  else if (f == rv64_andi) alu_ri(a, true, X::AND, rd, rs1, insn.i_imm());
+  else if (f == rv64_ori) alu_ri(a, true, X::OR, rd, rs1, insn.i_imm());
+  else if (f == rv64_xori) alu_ri(a, true, X::XOR, rd, rs1, insn.i_imm());
+  else if (f == rv64_slti) set_ri(a, X::CC_L, rd, rs1, insn.i_imm());
+  else if (f == rv64_sltiu) set_ri(a, X::CC_B, rd, rs1, insn.i_imm());
+  else if (f == rv64_slli) shift_ri(a, true, X::SHL, rd, rs1, insn.shamt());
+  else if (f == rv64_srli) shift_ri(a, true, X::SHR, rd, rs1, insn.shamt());
+  else if (f == rv64_srai) shift_ri(a, true, X::SAR, rd, rs1, insn.shamt());
+  else if (f == rv64_lui) li(a, rd, insn.u_imm());
+  else if (f == rv64_auipc) li(a, rd, insn.u_imm() + pc);
+  else if (f == rv64_addw) alu_rr(a, false, X::ADD, rd, rs1, rs2);
+  else if (f == rv64_subw) alu_rr(a, false, X::SUB, rd, rs1, rs2);
+  else if (f == rv64_sllw) shift_rr(a, false, X::SHL, rd, rs1, rs2);
+  else if (f == rv64_srlw) shift_rr(a, false, X::SHR, rd, rs1, rs2);
+  else if (f == rv64_sraw) shift_rr(a, false, X::SAR, rd, rs1, rs2);
+  else if (f == rv64_addiw) alu_ri(a, false, X::ADD, rd, rs1, insn.i_imm());
+  else if (f == rv64_slliw && insn.shamt() < 32) shift_ri(a, false, X::SHL, rd, rs1, insn.shamt());
+  else if (f == rv64_srliw && insn.shamt() < 32) shift_ri(a, false, X::SHR, rd, rs1, insn.shamt());
+  else if (f == rv64_sraiw && insn.shamt() < 32) shift_ri(a, false, X::SAR, rd, rs1, insn.shamt());
+  else if (f == rv64_lb) LOAD(true, 0x0fbe, rd, rs1, insn.i_imm(), 1);
+  else if (f == rv64_lh) LOAD(true, 0x0fbf, rd, rs1, insn.i_imm(), 2);
+  else if (f == rv64_lw) LOAD(true, 0x63, rd, rs1, insn.i_imm(), 4);
+  else if (f == rv64_ld) LOAD(true, 0x8b, rd, rs1, insn.i_imm(), 8);
+  else if (f == rv64_lbu) LOAD(false, 0x0fb6, rd, rs1, insn.i_imm(), 1);
+  else if (f == rv64_lhu) LOAD(false, 0x0fb7, rd, rs1, insn.i_imm(), 2);
+  else if (f == rv64_lwu) LOAD(false, 0x8b, rd, rs1, insn.i_imm(), 4);
+  else if (f == rv64_sb) STORE(0, false, 0x88, rs2, rs1, insn.s_imm(), 1);
+  else if (f == rv64_sh) STORE(0x66, false, 0x89, rs2, rs1, insn.s_imm(), 2);
+  else if (f == rv64_sw) STORE(0, false, 0x89, rs2, rs1, insn.s_imm(), 4);
+  else if (f == rv64_sd) STORE(0, true, 0x89, rs2, rs1, insn.s_imm(), 8);
+  else if (f == rv64_beq) { branch(a, X::CC_E, rs1, rs2, target, npc); return JUMP; }
+  else if (f == rv64_bne) { branch(a, X::CC_NE, rs1, rs2, target, npc); return JUMP; }
+  else if (f == rv64_blt) { branch(a, X::CC_L, rs1, rs2, target, npc); return JUMP; }
+  else if (f == rv64_bge) { branch(a, X::CC_GE, rs1, rs2, target, npc); return JUMP; }
+  else if (f == rv64_bltu) { branch(a, X::CC_B, rs1, rs2, target, npc); return JUMP; }
+  else if (f == rv64_bgeu) { branch(a, X::CC_AE, rs1, rs2, target, npc); return JUMP; }
+  else if (f == rv64_jal) { jump(a, rd, target, npc); return JUMP; }
+  else if (f == rv64_jalr) { jump_reg(a, has_c, rd, rs1, insn.i_imm(), npc, idx); return JUMP; }
+
+  // RV64M
+  else if (f == rv64_mul && has_m) mul(a, true, rd, rs1, rs2);
+  else if (f == rv64_mulw && has_m) mul(a, false, rd, rs1, rs2);
+  else if (f == rv64_mulh && has_m) mulh(a, true, rd, rs1, rs2);
+  else if (f == rv64_mulhu && has_m) mulh(a, false, rd, rs1, rs2);
+
+  // RV64C
+  else if (!has_c) return FAIL;
+  else if (f == rv64_c_addi)
+    alu_ri(a, true, X::ADD, insn.rvc_rd(), insn.rvc_rs1(), insn.rvc_imm());
+  else if (f == rv64_c_addi4spn && insn.rvc_addi4spn_imm() != 0)
+    alu_ri(a, true, X::ADD, insn.rvc_rs2s(), X_SP, insn.rvc_addi4spn_imm());
+  else if (f == rv64_c_li)
+    li(a, insn.rvc_rd(), insn.rvc_imm());
+  else if (f == rv64_c_lui && insn.rvc_rd() == X_SP && insn.rvc_addi16sp_imm() != 0)
+    alu_ri(a, true, X::ADD, X_SP, X_SP, insn.rvc_addi16sp_imm());
+  else if (f == rv64_c_lui && insn.rvc_rd() != X_SP && insn.rvc_imm() != 0)
+    li(a, insn.rvc_rd(), insn.rvc_imm() << 12);
+  else if (f == rv64_c_mv && insn.rvc_rs2() != 0)
+    alu_ri(a, true, X::ADD, insn.rvc_rd(), insn.rvc_rs2(), 0);
+  else if (f == rv64_c_add && insn.rvc_rs2() != 0)
+    alu_rr(a, true, X::ADD, insn.rvc_rd(), insn.rvc_rs1(), insn.rvc_rs2());
+  else if (f == rv64_c_jal && insn.rvc_rd() != 0) // c.addiw
+    alu_ri(a, false, X::ADD, insn.rvc_rd(), insn.rvc_rs1(), insn.rvc_imm());
+  else if (f == rv64_c_slli)
+    shift_ri(a, true, X::SHL, insn.rvc_rd(), insn.rvc_rs1(), insn.rvc_zimm());
+  else if (f == rv64_c_srli)
+    shift_ri(a, true, X::SHR, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_zimm());
+  else if (f == rv64_c_srai)
+    shift_ri(a, true, X::SAR, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_zimm());
+  else if (f == rv64_c_andi)
+    alu_ri(a, true, X::AND, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_imm());
+  else if (f == rv64_c_sub)
+    alu_rr(a, true, X::SUB, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+  else if (f == rv64_c_xor)
+    alu_rr(a, true, X::XOR, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+  else if (f == rv64_c_or)
+    alu_rr(a, true, X::OR, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+  else if (f == rv64_c_and)
+    alu_rr(a, true, X::AND, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+  else if (f == rv64_c_subw)
+    alu_rr(a, false, X::SUB, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+  else if (f == rv64_c_addw)
+    alu_rr(a, false, X::ADD, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+  else if (f == rv64_c_lw)
+    LOAD(true, 0x63, insn.rvc_rs2s(), insn.rvc_rs1s(), insn.rvc_lw_imm(), 4);
+  else if (f == rv64_c_flw) // c.ld
+    LOAD(true, 0x8b, insn.rvc_rs2s(), insn.rvc_rs1s(), insn.rvc_ld_imm(), 8);
+  else if (f == rv64_c_lwsp && insn.rvc_rd() != 0)
+    LOAD(true, 0x63, insn.rvc_rd(), X_SP, insn.rvc_lwsp_imm(), 4);
+  else if (f == rv64_c_flwsp && insn.rvc_rd() != 0) // c.ldsp
+    LOAD(true, 0x8b, insn.rvc_rd(), X_SP, insn.rvc_ldsp_imm(), 8);
+  else if (f == rv64_c_sw)
+    STORE(0, false, 0x89, insn.rvc_rs2s(), insn.rvc_rs1s(), insn.rvc_lw_imm(), 4);
+  else if (f == rv64_c_fsw) // c.sd
+    STORE(0, true, 0x89, insn.rvc_rs2s(), insn.rvc_rs1s(), insn.rvc_ld_imm(), 8);
+  else if (f == rv64_c_swsp)
+    STORE(0, false, 0x89, insn.rvc_rs2(), X_SP, insn.rvc_swsp_imm(), 4);
+  else if (f == rv64_c_fswsp) // c.sdsp
+    STORE(0, true, 0x89, insn.rvc_rs2(), X_SP, insn.rvc_sdsp_imm(), 8);
+  else if (f == rv64_c_j)
+    { jump(a, 0, pc + insn.rvc_j_imm(), npc); return JUMP; }
+  else if (f == rv64_c_beqz)
+    { branch(a, X::CC_E, insn.rvc_rs1s(), 0, pc + insn.rvc_b_imm(), npc); return JUMP; }
+  else if (f == rv64_c_bnez)
+    { branch(a, X::CC_NE, insn.rvc_rs1s(), 0, pc + insn.rvc_b_imm(), npc); return JUMP; }
+  else if (f == rv64_c_jr && insn.rvc_rs1() != 0)
+    { jump_reg(a, true, 0, insn.rvc_rs1(), 0, npc, idx); return JUMP; }
+  else if (f == rv64_c_jalr && insn.rvc_rs1() != 0)
+    { jump_reg(a, true, X_RA, insn.rvc_rs1(), 0, npc, idx); return JUMP; }
+  else
+    return FAIL;
+
+  #undef LOAD
+  #undef STORE
+
+  return OK;
+}
+
+jit_block_t* jit_t::compile(insn_block_t* block, reg_t pc)
+{
+  if (!code || proc->get_xlen() != 64)
+    return NULL;
+
+  // translate maximal runs of supported instructions. a run that reaches
+  // the end of the block stores the next PC, so execution can continue
+  // without returning to the interpreter.
+  jit_block_t native;
+  memset(&native, 0, sizeof(native));
+  std::vector<x86_asm_t> runs(block->length);
+  bool any = false;
+  reg_t start_pc = pc;
+
+  for (size_t i = 0; i < block->length; ) {
+    size_t start = i;
+    x86_asm_t& a = runs[start];
+    result_t result = FAIL;
+    while (i < block->length) {
+      insn_fetch_t fetch = block->insns[i];
+      x86_asm_t insn_code;
+      result = translate(insn_code, fetch, pc, i);
+      if (result == FAIL)
+        break;
+      a.append(insn_code);
+      native.offset[i] = pc - start_pc;
+      pc += fetch.insn.length();
+      i++;
+      if (result == JUMP)
+        break;
+    }
+
+    if (i > start) {
+      if (i == block->length && result != JUMP)
+        set_npc_imm(a, pc);
+      a.exit(i);
+      native.length[start] = i - start;
+      any = true;
+    } else {
+      native.offset[i] = pc - start_pc;
+      pc += block->insns[i].insn.length();
+      i++;
+    }
+  }
+
+  if (!any)
+    return NULL;
+
+  jit_block_t* result = (jit_block_t*)alloc(sizeof(jit_block_t));
+  if (!result)
+    return NULL;
+  *result = native;
+  for (size_t i = 0; i < block->length; i++) {
+    if (!native.length[i])
+      continue;
+    uint8_t* p = alloc(runs[i].buf.size());
+    if (!p)
+      return NULL;
+    memcpy(p, &runs[i].buf[0], runs[i].buf.size());
+    result->func[i] = (jit_func_t)p;
+  }
+
+  return result;
+}
@@ -0,0 +1,57 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_JIT_H
+#define _RISCV_JIT_H
+
+#include "decode.h"
+#include <stddef.h>
+#include <stdint.h>
+
+class processor_t;
+class mmu_t;
+class x86_asm_t;
+struct insn_fetch_t;
+struct insn_block_t;
+struct jit_block_t;
+
+// Translates runs of common RV64 integer instructions (ALU operations,
+// loads and stores, and the branch that ends a block) in hot blocks into
+// x86-64 host code. The generated code only reads and writes the integer
+// registers, the next PC, and memory that hits in the TLB. Anything that
+// might trap, such as a TLB miss or a misaligned access, returns to the
+// interpreter at that instruction, which then executes it as usual.
+class jit_t
+{
+public:
+  jit_t(processor_t* proc, mmu_t* mmu);
+  ~jit_t();
+
+  // whether host code can be generated on this host
+  bool supported() { return code != NULL; }
+
+  // translate what can be translated in a block starting at pc. returns
+  // NULL if nothing could be translated or the code buffer is full.
+  jit_block_t* compile(insn_block_t* block, reg_t pc);
+  bool full() { return is_full; }
+
+  // discard all generated code
+  void reset();
+
+private:
+  processor_t* proc;
+  mmu_t* mmu;
+  uint8_t* code;
+  size_t used;
+  bool is_full;
+
+  static const size_t CODE_SIZE = 16 << 20;
+
+  uint8_t* alloc(size_t len);
+
+  // emit code for the idxth instruction of a block; JUMP means that it
+  // also set the next PC
+  enum result_t { FAIL, OK, JUMP };
+  result_t translate(x86_asm_t& a, insn_fetch_t fetch, reg_t pc, size_t idx);
+};
+
+#endif
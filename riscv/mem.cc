@@ -0,0 +1,41 @@
+#include "devices.h"
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+
+mem_t::mem_t(size_t size, bool hugepages, int fd, size_t offset)
+  : len(size)
+{
+  if (!size)
+    throw std::runtime_error("zero bytes of target memory requested");
+
+  void* p = MAP_FAILED;
+  if (fd >= 0) {
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+  } else {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+    // reserve the huge pages now (no MAP_NORESERVE), so that a pool too
+    // small fails here rather than with SIGBUS on first touch
+    if (hugepages)
+      p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED) {
+      p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_NORESERVE, -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (hugepages && p != MAP_FAILED)
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+    }
+  }
+
+  if (p == MAP_FAILED)
+    throw std::runtime_error("couldn't map " + std::to_string(size) +
+                             " bytes of target memory: " + strerror(errno));
+  data = (char*)p;
+}
+
+mem_t::~mem_t()
+{
+  munmap(data, len);
+}
@@ -26,9 +26,14 @@ class memtracer_t
 class memtracer_list_t : public memtracer_t
 {
  public:
+  memtracer_list_t() : enabled(true) {}
   bool empty() { return list.empty(); }
+  // a disabled list is interested in nothing, so accesses take the fast path
+  void set_enabled(bool value) { enabled = value; }
   bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
   {
+    if (!enabled)
+      return false;
     for (std::vector<memtracer_t*>::iterator it = list.begin(); it != list.end(); ++it)
       if ((*it)->interested_in_range(begin, end, type))
         return true;
@@ -45,6 +50,7 @@ class memtracer_list_t : public memtracer_t
   }
  private:
   std::vector<memtracer_t*> list;
+  bool enabled;
 };
 
 #endif
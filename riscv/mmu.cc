@@ -3,26 +3,172 @@
 #include "mmu.h"
 #include "simif.h"
 #include "processor.h"
+#include <iostream>
+#include <iomanip>
+
+std::mutex mmu_t::amo_lock;
+std::mutex mmu_t::mmio_lock;
 
 mmu_t::mmu_t(simif_t* sim, processor_t* proc)
  : sim(sim), proc(proc),
+  parallel(false), icache_epoch(0), jit(NULL),
+  tlb_l1_misses(0), tlb_l2_hits(0), tlb_l2_super_hits(0), tlb_l2_misses(0),
+  pwc_hits(0), pwc_misses(0),
   check_triggers_fetch(false),
   check_triggers_load(false),
   check_triggers_store(false),
   matched_trigger(NULL)
 {
+  configure_tlb_l2(256, 4);
   flush_tlb();
   yield_load_reservation();
 }
 
 mmu_t::~mmu_t()
 {
+  delete jit;
+}
+
+void mmu_t::set_jit(bool value)
+{
+  flush_icache();
+  delete jit;
+  jit = NULL;
+  if (value && proc) {
+    jit = new jit_t(proc, this);
+    if (!jit->supported()) {
+      delete jit;
+      jit = NULL;
+    }
+  }
+}
+
+void mmu_t::compile_block(insn_block_t* block)
+{
+  block->jit = jit->compile(block, block->tag);
+  if (block->jit || !jit->full())
+    return;
+
+  // out of space for host code: start over with only this block
+  jit->reset();
+  for (size_t i = 0; i < BLOCK_ENTRIES; i++) {
+    blocks[i].jit = NULL;
+    blocks[i].hits = 0;
+  }
+  block->jit = jit->compile(block, block->tag);
 }
 
 void mmu_t::flush_icache()
 {
   for (size_t i = 0; i < ICACHE_ENTRIES; i++)
     icache[i].tag = -1;
+  for (size_t i = 0; i < BLOCK_ENTRIES; i++)
+    blocks[i].tag = -1;
+  memset(block_ppns, -1, sizeof(block_ppns));
+  code_pages.clear();
+  if (jit)
+    jit->reset();
+}
+
+void mmu_t::add_code_page(reg_t ppn)
+{
+  if (!code_pages.insert(ppn).second)
+    return;
+
+  // later stores to this page must take the slow path
+  for (size_t i = 0; i < TLB_ENTRIES; i++) {
+    reg_t vpn = tlb_store_tag[i] & ~TLB_CHECK_TRIGGERS;
+    if (tlb_store_tag[i] != reg_t(-1) &&
+        (tlb_data[i].target_offset + (vpn << PGSHIFT)) >> PGSHIFT == ppn)
+      tlb_store_tag[i] = -1;
+  }
+}
+
+void mmu_t::flush_code_page(reg_t ppn)
+{
+  if (!code_pages.erase(ppn))
+    return;
+
+  // the blocks' pages are kept apart from the blocks themselves, so that
+  // finding those from this page doesn't walk the whole block cache
+  for (size_t i = 0; i < BLOCK_ENTRIES; i++) {
+    if (block_ppns[i] == ppn) {
+      blocks[i].tag = -1;
+      block_ppns[i] = -1;
+    }
+  }
+
+  // decoded instructions from the page may outlive its blocks, and can be
+  // anywhere in the icache, so retire all of them at once
+  icache_epoch++;
+}
+
+// Instructions after which execution may not fall through to the next
+// sequential instruction, or after which the decoded code may be stale.
+static bool ends_block(insn_bits_t bits, int xlen)
+{
+  switch (bits & 3) {
+    case 1: // C.J, C.JAL, C.BEQZ, C.BNEZ
+      return (((bits >> 13) & 7) == 1 && xlen == 32) || ((bits >> 13) & 7) >= 5;
+    case 2: // C.JR, C.JALR, C.EBREAK
+      return ((bits >> 13) & 7) == 4 && ((bits >> 2) & 0x1f) == 0;
+    case 3:
+      switch (bits & 0x7f) {
+        case 0x63: // branches
+        case 0x67: // JALR
+        case 0x6f: // JAL
+        case 0x73: // SYSTEM
+          return true;
+        case 0x0f: // FENCE.I
+          return ((bits >> 12) & 7) == 1;
+        default:
+          return (bits & 0x1f) == 0x1f; // longer than 32 bits
+      }
+    default:
+      return false;
+  }
+}
+
+insn_block_t* mmu_t::refill_block(reg_t addr, insn_block_t* block)
+{
+  block->tag = -1;
+  block->insns[0] = access_icache(addr)->data;
+  block->length = 1;
+  block->hits = 0;
+  block->jit = NULL;
+  block->bbv_count = NULL;
+  block->prof_count = NULL;
+
+  // fetches that are traced or may match a trigger can't be cached
+  reg_t paddr = translate_insn_addr(addr).target_offset + addr;
+  if (check_triggers_fetch ||
+      tracer.interested_in_range(paddr & PGMASK, (paddr & PGMASK) + PGSIZE, FETCH))
+    return block;
+  block_ppns[block - blocks] = paddr >> PGSHIFT;
+  add_code_page(paddr >> PGSHIFT);
+
+  // the PC the debugger is running to or past gets a block of its own, so
+  // that its stop condition is checked on both sides of it
+  reg_t pc = addr;
+  while (addr != proc->stop_pc && block->length < insn_block_t::MAX_INSNS &&
+         !ends_block(block->insns[block->length - 1].insn.bits(), proc->get_xlen())) {
+    pc += block->insns[block->length - 1].insn.length();
+    if ((pc ^ addr) & PGMASK)
+      break;
+    // leave the PCs that open or close a logging window, or that the
+    // debugger is running to, to start blocks
+    if (pc == proc->log_trigger_pc || pc == proc->stop_pc)
+      break;
+    try {
+      block->insns[block->length] = access_icache(pc)->data;
+    } catch (trap_t& t) {
+      break; // take the fault when (and if) the instruction executes
+    }
+    block->length++;
+  }
+
+  block->tag = addr;
+  return block;
 }
 
 void mmu_t::flush_tlb()
@@ -30,10 +176,171 @@ void mmu_t::flush_tlb()
   memset(tlb_insn_tag, -1, sizeof(tlb_insn_tag));
   memset(tlb_load_tag, -1, sizeof(tlb_load_tag));
   memset(tlb_store_tag, -1, sizeof(tlb_store_tag));
+  mmio_dev = NULL;
+  mmio_base = mmio_size = 0;
+  tlb_l1_super_count = 0;
 
   flush_icache();
 }
 
+void mmu_t::sfence_vma(bool has_addr, reg_t vaddr, bool has_asid, reg_t asid)
+{
+  reg_t vpn = vaddr >> PGSHIFT;
+  reg_t asid_mask = proc && proc->max_xlen == 32 ? SATP32_ASID : SATP64_ASID;
+
+  for (auto& e : tlb_l2) {
+    if (e.vpn == reg_t(-1) || (has_addr && e.vpn != vpn))
+      continue;
+    if (has_asid && ((e.pte & PTE_G) || get_field(e.satp, asid_mask) != asid))
+      continue;
+    e.vpn = -1;
+  }
+
+  for (auto& e : tlb_l2_super) {
+    if (e.vpn == reg_t(-1) || (has_addr && e.vpn != (vpn & ~e.mask)))
+      continue;
+    if (has_asid && ((e.pte & PTE_G) || get_field(e.satp, asid_mask) != asid))
+      continue;
+    e.vpn = -1;
+  }
+
+  // the direct-mapped TLB holds each page of a superpage separately, so
+  // fencing any address in one forgets them all
+  bool superpage = tlb_l1_super_count > TLB_L1_SUPERPAGES;
+  for (size_t i = 0; i < tlb_l1_super_count && !superpage; i++)
+    superpage = (vpn & ~tlb_l1_super[i].mask) == tlb_l1_super[i].vpn;
+
+  // non-leaf PTEs aren't tagged with what they map, so drop them all
+  memset(pwc, -1, sizeof(pwc));
+
+  if (!has_addr || superpage) {
+    flush_tlb();
+    return;
+  }
+
+  // the direct-mapped TLB only holds the current address space, so just
+  // drop this page from it, and the code decoded from it
+  reg_t idx = vpn % TLB_ENTRIES;
+  if ((tlb_insn_tag[idx] & ~TLB_CHECK_TRIGGERS) == vpn)
+    tlb_insn_tag[idx] = -1;
+  if ((tlb_load_tag[idx] & ~TLB_CHECK_TRIGGERS) == vpn)
+    tlb_load_tag[idx] = -1;
+  if ((tlb_store_tag[idx] & ~TLB_CHECK_TRIGGERS) == vpn)
+    tlb_store_tag[idx] = -1;
+
+  // an instruction at the end of the previous page may extend into this one
+  for (size_t i = 0; i < ICACHE_ENTRIES; i++)
+    if ((icache[i].tag >> PGSHIFT) - vpn + 1 <= 1)
+      icache[i].tag = -1;
+  for (size_t i = 0; i < BLOCK_ENTRIES; i++)
+    if ((blocks[i].tag >> PGSHIFT) - vpn + 1 <= 1)
+      blocks[i].tag = -1;
+}
+
+void mmu_t::note_l1_superpage(reg_t vpn, reg_t mask)
+{
+  if (tlb_l1_super_count > TLB_L1_SUPERPAGES)
+    return;
+  for (size_t i = 0; i < tlb_l1_super_count; i++)
+    if (tlb_l1_super[i].vpn == vpn && tlb_l1_super[i].mask == mask)
+      return;
+  if (tlb_l1_super_count < TLB_L1_SUPERPAGES)
+    tlb_l1_super[tlb_l1_super_count] = {vpn, mask};
+  tlb_l1_super_count++;
+}
+
+void mmu_t::configure_tlb_l2(size_t sets, size_t ways)
+{
+  tlb_l2_sets = ways ? sets : 0;
+  tlb_l2_ways = sets ? ways : 0;
+  tlb_l2.assign(tlb_l2_sets * tlb_l2_ways, tlb_l2_entry_t());
+  flush_tlb_l2();
+}
+
+void mmu_t::flush_tlb_l2()
+{
+  for (auto& e : tlb_l2)
+    e.vpn = -1;
+  for (auto& e : tlb_l2_super)
+    e.vpn = -1;
+  memset(pwc, -1, sizeof(pwc));
+}
+
+mmu_t::tlb_l2_entry_t* mmu_t::tlb_l2_lookup(reg_t vpn, reg_t satp)
+{
+  if (tlb_l2_sets == 0)
+    return NULL;
+
+  // keep each set in most-recently-used order
+  tlb_l2_entry_t* set = &tlb_l2[(vpn % tlb_l2_sets) * tlb_l2_ways];
+  for (size_t i = 0; i < tlb_l2_ways; i++) {
+    if (set[i].vpn == vpn && set[i].satp == satp) {
+      tlb_l2_entry_t hit = set[i];
+      memmove(&set[1], &set[0], i * sizeof(*set));
+      set[0] = hit;
+      tlb_l2_hits++;
+      return &set[0];
+    }
+  }
+
+  for (size_t i = 0; i < TLB_SUPERPAGE_ENTRIES; i++) {
+    tlb_l2_entry_t* e = &tlb_l2_super[i];
+    if (e->vpn == (vpn & ~e->mask) && e->satp == satp) {
+      tlb_l2_entry_t hit = *e;
+      memmove(&tlb_l2_super[1], &tlb_l2_super[0], i * sizeof(*e));
+      tlb_l2_super[0] = hit;
+      tlb_l2_super_hits++;
+      return &tlb_l2_super[0];
+    }
+  }
+
+  tlb_l2_misses++;
+  return NULL;
+}
+
+void mmu_t::tlb_l2_insert(reg_t vpn, reg_t satp, reg_t pte, reg_t mask)
+{
+  if (tlb_l2_sets == 0)
+    return;
+
+  tlb_l2_entry_t* set = &tlb_l2[(vpn % tlb_l2_sets) * tlb_l2_ways];
+  size_t ways = tlb_l2_ways;
+  if (mask) {
+    set = tlb_l2_super;
+    ways = TLB_SUPERPAGE_ENTRIES;
+    vpn &= ~mask;
+  }
+
+  size_t i = 0;
+  while (i < ways - 1 && !(set[i].vpn == vpn && set[i].satp == satp))
+    i++;
+  memmove(&set[1], &set[0], i * sizeof(*set));
+  set[0] = {vpn, satp, pte, mask};
+}
+
+void mmu_t::print_tlb_stats()
+{
+  uint64_t accesses = tlb_l2_hits + tlb_l2_super_hits + tlb_l2_misses;
+  if (tlb_l1_misses == 0)
+    return;
+
+  std::cout << std::setprecision(3) << std::fixed;
+  std::cout << "TLB" << proc->id << " L1 Misses:          " << tlb_l1_misses << std::endl;
+  std::cout << "TLB" << proc->id << " L2 Hits:            " << tlb_l2_hits << std::endl;
+  std::cout << "TLB" << proc->id << " L2 Superpage Hits:  " << tlb_l2_super_hits << std::endl;
+  std::cout << "TLB" << proc->id << " L2 Misses:          " << tlb_l2_misses << std::endl;
+  if (accesses)
+    std::cout << "TLB" << proc->id << " L2 Miss Rate:       "
+              << 100.0f * tlb_l2_misses / accesses << '%' << std::endl;
+
+  uint64_t walks = pwc_hits + pwc_misses;
+  std::cout << "TLB" << proc->id << " Walk Cache Hits:    " << pwc_hits << std::endl;
+  std::cout << "TLB" << proc->id << " Walk Cache Misses:  " << pwc_misses << std::endl;
+  if (walks)
+    std::cout << "TLB" << proc->id << " Walk Cache Miss Rate: "
+              << 100.0f * pwc_misses / walks << '%' << std::endl;
+}
+
 static void throw_access_exception(reg_t addr, access_type type)
 {
   switch (type) {
@@ -49,6 +356,7 @@ reg_t mmu_t::translate(reg_t addr, reg_t len, access_type type)
   if (!proc)
     return addr;
 
+  tlb_l1_misses++;
   reg_t mode = proc->state.prv;
   if (type != FETCH) {
     if (!proc->state.debug_mode && get_field(proc->state.mstatus, MSTATUS_MPRV))
@@ -110,11 +418,30 @@ bool mmu_t::mmio_ok(reg_t addr, access_type type)
   return true;
 }
 
+abstract_device_t* mmu_t::mmio_device(reg_t addr, size_t len)
+{
+  if (addr - mmio_base >= mmio_size) {
+    mmio_dev = sim->mmio_device(addr, &mmio_base, &mmio_size);
+    if (!mmio_dev)
+      mmio_size = 0;
+  }
+
+  // accesses that run off the end of the device take the checked path
+  if (!mmio_dev || len > mmio_size - (addr - mmio_base))
+    return NULL;
+  return mmio_dev;
+}
+
 bool mmu_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
 {
   if (!mmio_ok(addr, LOAD))
     return false;
 
+  std::unique_lock<std::mutex> guard;
+  if (parallel)
+    guard = std::unique_lock<std::mutex>(mmio_lock);
+  if (auto dev = mmio_device(addr, len))
+    return dev->load(addr - mmio_base, len, bytes);
   return sim->mmio_load(addr, len, bytes);
 }
 
@@ -123,6 +450,11 @@ bool mmu_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
   if (!mmio_ok(addr, STORE))
     return false;
 
+  std::unique_lock<std::mutex> guard;
+  if (parallel)
+    guard = std::unique_lock<std::mutex>(mmio_lock);
+  if (auto dev = mmio_device(addr, len))
+    return dev->store(addr - mmio_base, len, bytes);
   return sim->mmio_store(addr, len, bytes);
 }
 
@@ -161,6 +493,7 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes)
 
   if (auto host_addr = sim->addr_to_mem(paddr)) {
     memcpy(host_addr, bytes, len);
+    flush_code_page(paddr >> PGSHIFT);
     if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
       tracer.trace(paddr, len, STORE);
     else
@@ -170,6 +503,15 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes)
   }
 }
 
+void mmu_t::atomic_store_done(reg_t addr, reg_t paddr, char* host_addr, reg_t len)
+{
+  flush_code_page(paddr >> PGSHIFT);
+  if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
+    tracer.trace(paddr, len, STORE);
+  else
+    refill_tlb(addr, paddr, host_addr, STORE);
+}
+
 tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type)
 {
   reg_t idx = (vaddr >> PGSHIFT) % TLB_ENTRIES;
@@ -187,9 +529,14 @@ tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_
       (check_triggers_store && type == STORE))
     expected_tag |= TLB_CHECK_TRIGGERS;
 
+  // stores to pages holding decoded code must keep taking the slow path,
+  // which invalidates the blocks they overwrite
   if (pmp_homogeneous(paddr & ~reg_t(PGSIZE - 1), PGSIZE)) {
     if (type == FETCH) tlb_insn_tag[idx] = expected_tag;
-    else if (type == STORE) tlb_store_tag[idx] = expected_tag;
+    else if (type == STORE) {
+      if (!code_pages.count(paddr >> PGSHIFT))
+        tlb_store_tag[idx] = expected_tag;
+    }
     else tlb_load_tag[idx] = expected_tag;
   }
 
@@ -285,6 +632,18 @@ reg_t mmu_t::pmp_homogeneous(reg_t addr, reg_t len)
   return true;
 }
 
+// whether a valid leaf PTE grants an access, ignoring its A and D bits
+static bool pte_permits(reg_t pte, access_type type, bool s_mode, bool sum, bool mxr)
+{
+  if ((pte & PTE_U) ? s_mode && (type == FETCH || !sum) : !s_mode)
+    return false;
+  if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W)))
+    return false;
+  return type == FETCH ? (pte & PTE_X) :
+         type == LOAD ?  (pte & PTE_R) || (mxr && (pte & PTE_X)) :
+                         (pte & PTE_R) && (pte & PTE_W);
+}
+
 reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
 {
   vm_info vm = decode_vm_info(proc->max_xlen, mode, proc->get_state()->satp);
@@ -302,8 +661,38 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
   if (masked_msbs != 0 && masked_msbs != mask)
     vm.levels = 0;
 
+  // a cached translation is only used if it needs no update; anything else
+  // (including a fault) is decided by a full walk
+  reg_t satp = proc->get_state()->satp;
+  reg_t ad = PTE_A | ((type == STORE) * PTE_D);
+  if (vm.levels != 0) {
+    if (auto e = tlb_l2_lookup(addr >> PGSHIFT, satp)) {
+      if (pte_permits(e->pte, type, s_mode, sum, mxr) && (e->pte & ad) == ad) {
+        if (e->mask)
+          note_l1_superpage(e->vpn, e->mask);
+        return ((e->pte >> PTE_PPN_SHIFT) | ((addr >> PGSHIFT) & e->mask)) << PGSHIFT;
+      }
+    }
+  }
+
+  // resume from the deepest page table a previous walk passed through
   reg_t base = vm.ptbase;
-  for (int i = vm.levels - 1; i >= 0; i--) {
+  int level = vm.levels - 1;
+  for (int i = 0; i < level; i++) {
+    reg_t prefix = addr >> (PGSHIFT + (i + 1) * vm.idxbits);
+    pwc_entry_t* e = &pwc[i][prefix % PWC_ENTRIES];
+    if (e->prefix == prefix && e->satp == satp) {
+      base = e->base;
+      level = i;
+      break;
+    }
+  }
+  if (level < vm.levels - 1)
+    pwc_hits++;
+  else if (vm.levels != 0)
+    pwc_misses++;
+
+  for (int i = level; i >= 0; i--) {
     int ptshift = i * vm.idxbits;
     reg_t idx = (addr >> (PGSHIFT + ptshift)) & ((1 << vm.idxbits) - 1);
 
@@ -318,24 +707,22 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
 
     if (PTE_TABLE(pte)) { // next level of page table
       base = ppn << PGSHIFT;
-    } else if ((pte & PTE_U) ? s_mode && (type == FETCH || !sum) : !s_mode) {
-      break;
-    } else if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) {
-      break;
-    } else if (type == FETCH ? !(pte & PTE_X) :
-               type == LOAD ?  !(pte & PTE_R) && !(mxr && (pte & PTE_X)) :
-                               !((pte & PTE_R) && (pte & PTE_W))) {
+      if (i > 0) {
+        reg_t prefix = addr >> (PGSHIFT + ptshift);
+        pwc[i - 1][prefix % PWC_ENTRIES] = {prefix, satp, base};
+      }
+    } else if (!pte_permits(pte, type, s_mode, sum, mxr)) {
       break;
     } else if ((ppn & ((reg_t(1) << ptshift) - 1)) != 0) {
       break;
     } else {
-      reg_t ad = PTE_A | ((type == STORE) * PTE_D);
 #ifdef RISCV_ENABLE_DIRTY
       // set accessed and possibly dirty bits.
       if ((pte & ad) != ad) {
         if (!pmp_ok(pte_paddr, vm.ptesize, STORE, PRV_S))
           throw_access_exception(addr, type);
-        *(uint32_t*)ppte |= to_le((uint32_t)ad);
+        __atomic_fetch_or((uint32_t*)ppte, to_le((uint32_t)ad), __ATOMIC_RELAXED);
+        pte |= ad;
       }
 #else
       // take exception if access or possibly dirty bit is not set.
@@ -343,9 +730,14 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
         break;
 #endif
       // for superpage mappings, make a fake leaf PTE for the TLB's benefit.
+      // every refill of the direct-mapped TLB follows a walk, so noting the
+      // superpage here covers whatever pieces of it that TLB ends up holding
       reg_t vpn = addr >> PGSHIFT;
-      reg_t value = (ppn | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
-      return value;
+      reg_t mask = (reg_t(1) << ptshift) - 1;
+      tlb_l2_insert(vpn, satp, pte, mask);
+      if (mask)
+        note_l1_superpage(vpn & ~mask, mask);
+      return (ppn | (vpn & mask)) << PGSHIFT;
     }
   }
 
@@ -362,3 +754,9 @@ void mmu_t::register_memtracer(memtracer_t* t)
   flush_tlb();
   tracer.hook(t);
 }
+
+void mmu_t::set_tracing(bool enabled)
+{
+  flush_tlb();
+  tracer.set_enabled(enabled);
+}
@@ -11,8 +11,12 @@
 #include "processor.h"
 #include "memtracer.h"
 #include "byteorder.h"
+#include "jit.h"
 #include <stdlib.h>
 #include <vector>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
 
 // virtual memory configuration
 #define PGSHIFT 12
@@ -28,10 +32,34 @@ struct insn_fetch_t
 
 struct icache_entry_t {
   reg_t tag;
+  uint64_t epoch; // of the instruction cache when the entry was filled
   struct icache_entry_t* next;
   insn_fetch_t data;
 };
 
+// a run of straight-line instructions, decoded once and executed together
+struct insn_block_t {
+  static const size_t MAX_INSNS = 16;
+  reg_t tag;
+  size_t length;
+  size_t hits;
+  jit_block_t* jit; // host code for parts of the block, if any
+  uint64_t* bbv_count; // basic-block vector counter, once looked up
+  uint64_t* prof_count; // profile counter, once looked up
+  insn_fetch_t insns[MAX_INSNS];
+};
+
+// host code for a block. if length[i] is nonzero, func[i] performs up to
+// length[i] instructions starting with the block's ith, and returns the
+// index of the next instruction to execute. if that is the end of the
+// block, func[i] has set *npc.
+typedef size_t (*jit_func_t)(reg_t* xpr, reg_t* npc);
+struct jit_block_t {
+  jit_func_t func[insn_block_t::MAX_INSNS];
+  uint8_t length[insn_block_t::MAX_INSNS];
+  uint8_t offset[insn_block_t::MAX_INSNS]; // of each instruction's PC
+};
+
 struct tlb_entry_t {
   char* host_offset;
   reg_t target_offset;
@@ -80,12 +108,11 @@ public:
 #endif
   }
 
-#ifndef RISCV_ENABLE_COMMITLOG
-# define READ_MEM(addr, size) ({})
-#else
-# define READ_MEM(addr, size) \
-  proc->state.log_mem_read.push_back(std::make_tuple(addr, 0, size));
-#endif
+#define READ_MEM(addr, size) \
+  do { \
+    if (unlikely(proc->get_log_commits_enabled())) \
+      proc->state.log_mem_read.push_back(std::make_tuple(addr, 0, size)); \
+  } while (0)
 
   // template for functions that load an aligned value from memory
   #define load_func(type) \
@@ -126,12 +153,11 @@ public:
   load_func(int32)
   load_func(int64)
 
-#ifndef RISCV_ENABLE_COMMITLOG
-# define WRITE_MEM(addr, value, size) ({})
-#else
-# define WRITE_MEM(addr, val, size) \
-  proc->state.log_mem_write.push_back(std::make_tuple(addr, val, size));
-#endif
+#define WRITE_MEM(addr, val, size) \
+  do { \
+    if (unlikely(proc->get_log_commits_enabled())) \
+      proc->state.log_mem_write.push_back(std::make_tuple(addr, val, size)); \
+  } while (0)
 
   // template for functions that store an aligned value to memory
   #define store_func(type) \
@@ -166,6 +192,13 @@ public:
     type##_t amo_##type(reg_t addr, op f) { \
       if (addr & (sizeof(type##_t)-1)) \
         throw trap_store_address_misaligned(addr); \
+      std::unique_lock<std::mutex> guard; \
+      if (parallel) { \
+        type##_t lhs; \
+        if (atomic_amo(addr, f, &lhs)) \
+          return lhs; \
+        guard = std::unique_lock<std::mutex>(amo_lock); \
+      } \
       try { \
         auto lhs = load_##type(addr); \
         store_##type(addr, f(lhs)); \
@@ -204,24 +237,86 @@ public:
   store_func(uint32)
   store_func(uint64)
 
+  // the host address of the len bytes at addr, if they lie on one page
+  // that the TLB lets loads (stores) access directly, with no triggers to
+  // check; else NULL. for bulk accesses, which fall back to load_*
+  // (store_*) to refill the TLB or take the fault, and do their own logging.
+  inline const char* load_host_addr(reg_t addr, reg_t len)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    if (((addr + len - 1) >> PGSHIFT) != vpn || tlb_load_tag[vpn % TLB_ENTRIES] != vpn)
+      return NULL;
+    return tlb_data[vpn % TLB_ENTRIES].host_offset + addr;
+  }
+
+  inline char* store_host_addr(reg_t addr, reg_t len)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    if (((addr + len - 1) >> PGSHIFT) != vpn || tlb_store_tag[vpn % TLB_ENTRIES] != vpn)
+      return NULL;
+    return tlb_data[vpn % TLB_ENTRIES].host_offset + addr;
+  }
+
   // perform an atomic memory operation at an aligned address
   amo_func(uint32)
   amo_func(uint64)
 
+  // template for functions that perform a store-conditional; when harts run
+  // in parallel, the store only succeeds if memory still holds the value
+  // returned by the matching load-reserved
+  #define store_conditional_func(type) \
+    bool store_conditional_##type(reg_t addr, type##_t val) { \
+      if (!check_load_reservation(addr, sizeof(type##_t))) \
+        return false; \
+      if (!parallel) { \
+        store_##type(addr, val); \
+        return true; \
+      } \
+      if (check_triggers_store && !matched_trigger) { \
+        matched_trigger = trigger_exception(OPERATION_STORE, addr, val); \
+        if (matched_trigger) \
+          throw *matched_trigger; \
+      } \
+      type##_t expected = to_le((type##_t)load_reservation_value); \
+      if (!__atomic_compare_exchange_n((type##_t*)load_reservation_host, &expected, to_le(val), \
+                                       false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) \
+        return false; \
+      if (tlb_store_tag[(addr >> PGSHIFT) % TLB_ENTRIES] != (addr >> PGSHIFT)) \
+        atomic_store_done(addr, load_reservation_address, load_reservation_host, sizeof(type##_t)); \
+      if (proc) WRITE_MEM(addr, val, sizeof(type##_t)); \
+      return true; \
+    }
+
+  store_conditional_func(uint32)
+  store_conditional_func(uint64)
+
   inline void yield_load_reservation()
   {
     load_reservation_address = (reg_t)-1;
   }
 
-  inline void acquire_load_reservation(reg_t vaddr)
+  inline void acquire_load_reservation(reg_t vaddr, reg_t value)
   {
     reg_t paddr = translate(vaddr, 1, LOAD);
-    if (auto host_addr = sim->addr_to_mem(paddr))
+    if (auto host_addr = sim->addr_to_mem(paddr)) {
       load_reservation_address = refill_tlb(vaddr, paddr, host_addr, LOAD).target_offset + vaddr;
-    else
+      load_reservation_host = host_addr;
+      load_reservation_value = value;
+    } else {
       throw trap_load_access_fault(vaddr); // disallow LR to I/O space
+    }
+  }
+
+  // order this hart's memory accesses against those of other host threads
+  inline void fence()
+  {
+    if (parallel)
+      std::atomic_thread_fence(std::memory_order_seq_cst);
   }
 
+  // set when other harts may access memory concurrently from other threads
+  void set_parallel(bool value) { parallel = value; }
+
   inline bool check_load_reservation(reg_t vaddr, size_t size)
   {
     if (vaddr & (size-1))
@@ -263,6 +358,7 @@ public:
 
     insn_fetch_t fetch = {proc->decode_insn(insn), insn};
     entry->tag = addr;
+    entry->epoch = icache_epoch;
     entry->next = &icache[icache_index(addr + length)];
     entry->data = fetch;
 
@@ -277,7 +373,7 @@ public:
   inline icache_entry_t* access_icache(reg_t addr)
   {
     icache_entry_t* entry = &icache[icache_index(addr)];
-    if (likely(entry->tag == addr))
+    if (likely(entry->tag == addr && entry->epoch == icache_epoch))
       return entry;
     return refill_icache(addr, entry);
   }
@@ -288,10 +384,52 @@ public:
     return refill_icache(addr, &entry)->data;
   }
 
+  static const reg_t BLOCK_ENTRIES = 1024;
+
+  inline size_t block_index(reg_t addr)
+  {
+    return (addr / PC_ALIGN) % BLOCK_ENTRIES;
+  }
+
+  // look up the block of instructions starting at addr, decoding it on a
+  // miss. a block ends at a control transfer, at a page boundary, or after
+  // MAX_INSNS instructions.
+  inline insn_block_t* access_block(reg_t addr)
+  {
+    insn_block_t* block = &blocks[block_index(addr)];
+    if (likely(block->tag == addr)) {
+      if (unlikely(jit != NULL) && ++block->hits == JIT_THRESHOLD)
+        compile_block(block);
+      return block;
+    }
+    return refill_block(addr, block);
+  }
+
+  // translate blocks into host code once they have run JIT_THRESHOLD times
+  void set_jit(bool value);
+
   void flush_tlb();
   void flush_icache();
 
+  // the physical address a load from addr would use, for the debugger
+  reg_t translate_load(reg_t addr) { return translate(addr, 1, LOAD); }
+
+  // sfence.vma: flush cached translations of vaddr (if has_addr) in the
+  // address space asid (if has_asid), and all cached page-table pointers
+  void sfence_vma(bool has_addr, reg_t vaddr, bool has_asid, reg_t asid);
+
+  // The second-level TLB is a set-associative cache of leaf PTEs behind
+  // the direct-mapped TLB. Its entries are tagged with the satp (and so the
+  // ASID) they were found under, and permissions are checked on every use,
+  // so it survives satp writes and privilege changes. Superpages take one
+  // entry each rather than one per 4 KiB page. sets == 0 disables it.
+  void configure_tlb_l2(size_t sets, size_t ways);
+  // forget everything the second-level TLB and page-walk cache hold
+  void flush_tlb_l2();
+  void print_tlb_stats();
+
   void register_memtracer(memtracer_t*);
+  void set_tracing(bool enabled);
 
   int is_dirty_enabled()
   {
@@ -316,10 +454,30 @@ private:
   processor_t* proc;
   memtracer_list_t tracer;
   reg_t load_reservation_address;
+  char* load_reservation_host;
+  reg_t load_reservation_value;
+  bool parallel;
+  static std::mutex amo_lock;
+  static std::mutex mmio_lock;
   uint16_t fetch_temp;
 
-  // implement an instruction cache for simulator performance
+  // implement an instruction cache for simulator performance. entries
+  // filled before the last store to code are stale.
   icache_entry_t icache[ICACHE_ENTRIES];
+  uint64_t icache_epoch;
+
+  // cache basic blocks built from the instruction cache. stores to pages
+  // in code_pages bypass the TLB, so that they can invalidate the blocks
+  // (and icache entries) they overwrite.
+  insn_block_t blocks[BLOCK_ENTRIES];
+  reg_t block_ppns[BLOCK_ENTRIES]; // physical page each block came from
+  std::unordered_set<reg_t> code_pages;
+  insn_block_t* refill_block(reg_t addr, insn_block_t* block);
+  jit_t* jit;
+  static const size_t JIT_THRESHOLD = 64;
+  void compile_block(insn_block_t* block);
+  void add_code_page(reg_t ppn);
+  void flush_code_page(reg_t ppn);
 
   // implement a TLB for simulator performance
   static const reg_t TLB_ENTRIES = 256;
@@ -330,6 +488,99 @@ private:
   reg_t tlb_insn_tag[TLB_ENTRIES];
   reg_t tlb_load_tag[TLB_ENTRIES];
   reg_t tlb_store_tag[TLB_ENTRIES];
+  // superpages whose pages the direct-mapped TLB may hold, kept apart from
+  // the L2, which may have evicted them or be disabled
+  struct tlb_superpage_t {
+    reg_t vpn;
+    reg_t mask;
+  };
+  static const size_t TLB_L1_SUPERPAGES = 16;
+  tlb_superpage_t tlb_l1_super[TLB_L1_SUPERPAGES];
+  size_t tlb_l1_super_count; // TLB_L1_SUPERPAGES + 1 once any went unrecorded
+  void note_l1_superpage(reg_t vpn, reg_t mask);
+
+  struct tlb_l2_entry_t {
+    reg_t vpn;
+    reg_t satp;
+    reg_t pte; // leaf PTE
+    reg_t mask; // low vpn bits spanned by the leaf (nonzero for superpages)
+  };
+  std::vector<tlb_l2_entry_t> tlb_l2;
+  size_t tlb_l2_sets;
+  size_t tlb_l2_ways;
+  // megapages and gigapages live in a small fully-associative array, one
+  // entry per superpage, kept in most-recently-used order
+  static const size_t TLB_SUPERPAGE_ENTRIES = 16;
+  tlb_l2_entry_t tlb_l2_super[TLB_SUPERPAGE_ENTRIES];
+  uint64_t tlb_l1_misses;
+  uint64_t tlb_l2_hits;
+  uint64_t tlb_l2_super_hits;
+  uint64_t tlb_l2_misses;
+  tlb_l2_entry_t* tlb_l2_lookup(reg_t vpn, reg_t satp);
+  void tlb_l2_insert(reg_t vpn, reg_t satp, reg_t pte, reg_t mask);
+
+  // page-walk cache: for each level, the page tables most recently reached
+  // by a walk, tagged with satp and the vpn bits that selected them
+  static const size_t PWC_LEVELS = 5;
+  static const size_t PWC_ENTRIES = 64;
+  struct pwc_entry_t {
+    reg_t prefix;
+    reg_t satp;
+    reg_t base;
+  };
+  pwc_entry_t pwc[PWC_LEVELS][PWC_ENTRIES];
+  uint64_t pwc_hits;
+  uint64_t pwc_misses;
+
+  // perform an AMO with a host atomic when harts run in parallel; returns
+  // false, without touching memory, if the target is not RAM
+  template<typename T, typename op>
+  bool atomic_amo(reg_t addr, op f, T* result)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    if (likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn)) {
+      *result = atomic_update(addr, (T*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr), f, false);
+      return true;
+    }
+
+    // AMOs are reported as store faults, so translate for write permission
+    reg_t paddr = translate(addr, sizeof(T), STORE);
+    char* host_addr = sim->addr_to_mem(paddr);
+    if (!host_addr)
+      return false;
+    *result = atomic_update(addr, (T*)host_addr, f, true);
+    if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
+      tracer.trace(paddr, sizeof(T), LOAD);
+    atomic_store_done(addr, paddr, host_addr, sizeof(T));
+    return true;
+  }
+
+  // compare-and-swap loop; triggers see each candidate load and store value
+  // before the swap, so a match leaves memory untouched
+  template<typename T, typename op>
+  T atomic_update(reg_t addr, T* host_addr, op f, bool check_triggers)
+  {
+    T lhs = __atomic_load_n(host_addr, __ATOMIC_RELAXED);
+    T rhs;
+    do {
+      rhs = f(from_le(lhs));
+      if (check_triggers && !matched_trigger) {
+        matched_trigger = trigger_exception(OPERATION_LOAD, addr, from_le(lhs));
+        if (!matched_trigger)
+          matched_trigger = trigger_exception(OPERATION_STORE, addr, rhs);
+        if (matched_trigger)
+          throw *matched_trigger;
+      }
+    } while (!__atomic_compare_exchange_n(host_addr, &lhs, to_le(rhs),
+                                          true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    if (proc) READ_MEM(addr, sizeof(T));
+    if (proc) WRITE_MEM(addr, rhs, sizeof(T));
+    return from_le(lhs);
+  }
+
+  // after a slow-path AMO or SC: drop stale decoded code, then trace the
+  // access or refill the TLB
+  void atomic_store_done(reg_t addr, reg_t paddr, char* host_addr, reg_t len);
 
   // finish translation on a TLB miss and update the TLB
   tlb_entry_t refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type);
@@ -345,6 +596,12 @@ private:
   bool mmio_load(reg_t addr, size_t len, uint8_t* bytes);
   bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes);
   bool mmio_ok(reg_t addr, access_type type);
+  abstract_device_t* mmio_device(reg_t addr, size_t len);
+
+  // the MMIO device most recently accessed, and the range it decodes
+  abstract_device_t* mmio_dev;
+  reg_t mmio_base;
+  reg_t mmio_size;
   reg_t translate(reg_t addr, reg_t len, access_type type);
 
   // ITLB lookup
@@ -397,6 +654,7 @@ private:
   trigger_matched_t *matched_trigger;
 
   friend class processor_t;
+  friend class jit_t;
 };
 
 struct vm_info {
@@ -1,6 +1,10 @@
 // See LICENSE for license details.
 
 #include "processor.h"
+#include "checkpoint.h"
+#include "bbv.h"
+#include "profile.h"
+#include "callgraph.h"
 #include "extension.h"
 #include "common.h"
 #include "config.h"
@@ -24,11 +28,15 @@ processor_t::processor_t(const char* isa, const char* priv, const char* varch,
                          simif_t* sim, uint32_t id, bool halt_on_reset,
                          FILE* log_file)
   : debug(false), halt_request(HR_NONE), sim(sim), ext(NULL), id(id), xlen(0),
-  histogram_enabled(false), log_commits_enabled(false),
+  profiler(NULL), callgraph(NULL), bbv(NULL), log_commits_enabled(false),
+  host_fp(false), commit_trace(NULL), commit_trace_index(0), log_trigger_pc(-1),
+  log_window_open(false), log_window_log(false), log_window_commits(false),
+  stop_pc(-1),
   log_file(log_file), halt_on_reset(halt_on_reset),
   extension_table(256, false), last_pc(1), executions(1)
 {
   VU.p = this;
+  log_trigger.type = log_trigger_t::NONE;
 
   parse_isa_string(isa);
   parse_priv_string(priv);
@@ -49,15 +57,9 @@ processor_t::processor_t(const char* isa, const char* priv, const char* varch,
 
 processor_t::~processor_t()
 {
-#ifdef RISCV_ENABLE_HISTOGRAM
-  if (histogram_enabled)
-  {
-    fprintf(stderr, "PC Histogram size:%zu\n", pc_histogram.size());
-    for (auto it : pc_histogram)
-      fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.first, it.second);
-  }
-#endif
-
+  delete profiler;
+  delete callgraph;
+  delete bbv;
   delete mmu;
   delete disassembler;
 }
@@ -354,14 +356,12 @@ void state_t::reset(reg_t max_isa)
   frm = 0;
   serialized = false;
 
-#ifdef RISCV_ENABLE_COMMITLOG
   log_reg_write.clear();
   log_mem_read.clear();
   log_mem_write.clear();
   last_inst_priv = 0;
   last_inst_xlen = 0;
   last_inst_flen = 0;
-#endif
 }
 
 void processor_t::vectorUnit_t::reset(){
@@ -369,7 +369,10 @@ void processor_t::vectorUnit_t::reset(){
   VLEN = get_vlen();
   ELEN = get_elen();
   SLEN = get_slen(); // registers are simply concatenated
-  reg_file = malloc(NVPR * (VLEN/8));
+  lg_vlenb = __builtin_ctzll(VLEN / 8);
+  // aligned for host vector loads and stores of whole registers
+  if (posix_memalign(&reg_file, 64, NVPR * (VLEN/8)) != 0)
+    throw std::bad_alloc();
 
   vtype = 0;
   set_vl(0, 0, 0, -1); // default to illegal configuration
@@ -425,24 +428,110 @@ void processor_t::set_debug(bool value)
     ext->set_debug(value);
 }
 
-void processor_t::set_histogram(bool value)
+void processor_t::set_bbv(const std::string& path, uint64_t interval)
 {
-  histogram_enabled = value;
-#ifndef RISCV_ENABLE_HISTOGRAM
-  if (value) {
-    fprintf(stderr, "PC Histogram support has not been properly enabled;");
-    fprintf(stderr, " please re-build the riscv-isa-sim project using \"configure --enable-histogram\".\n");
-    abort();
+  delete bbv;
+  bbv = new bbv_t(path, interval);
+  mmu->flush_icache();
+}
+
+void processor_t::set_profiling(bool value)
+{
+  delete profiler;
+  profiler = value ? new profiler_t : NULL;
+  mmu->flush_icache();
+}
+
+void processor_t::set_callgraph(bool value)
+{
+  delete callgraph;
+  callgraph = value ? new callgraph_t(max_xlen) : NULL;
+}
+
+void processor_t::set_log_commits(bool value)
+{
+  log_commits_enabled = value;
+  // decoded instructions are cached, so flush them to switch variants
+  mmu->flush_icache();
+}
+
+void processor_t::set_commit_trace(commit_trace_t* trace, size_t index)
+{
+  commit_trace = trace;
+  commit_trace_index = index;
+}
+
+void processor_t::set_log_window(const log_trigger_t& start, const log_trigger_t& stop,
+                                 bool log, bool log_commits)
+{
+  log_start = start;
+  log_stop = stop;
+  log_window_log = log;
+  log_window_commits = log_commits;
+  log_window_open = true;
+  toggle_log_window();
+  if (start.type == log_trigger_t::NONE || (start.type == log_trigger_t::INSTRET &&
+                                            start.value <= state.minstret))
+    toggle_log_window();
+}
+
+void processor_t::toggle_log_window()
+{
+  log_window_open = !log_window_open;
+  log_trigger = log_window_open ? log_stop : log_start;
+  // an instruction count that has gone by won't come again
+  if (log_trigger.type == log_trigger_t::INSTRET && log_trigger.value <= state.minstret)
+    log_trigger.type = log_trigger_t::NONE;
+  log_trigger_pc = log_trigger.type == log_trigger_t::PC ? log_trigger.value : -1;
+
+  if (log_window_log)
+    set_debug(log_window_open);
+  // also flushes the blocks that run past the new trigger PC
+  set_log_commits(log_window_commits && log_window_open);
+}
+
+void processor_t::set_stop_condition(std::function<bool()> cond, reg_t pc)
+{
+  stop_condition = cond;
+  if (pc != stop_pc) {
+    stop_pc = pc;
+    mmu->flush_icache();
   }
-#endif
 }
 
-#ifdef RISCV_ENABLE_COMMITLOG
-void processor_t::enable_log_commits()
+bool parse_log_trigger(const std::string& s, log_trigger_t* trigger)
 {
-  log_commits_enabled = true;
+  size_t eq = s.find('=');
+  if (eq == std::string::npos || eq + 1 == s.size())
+    return false;
+  std::string kind = s.substr(0, eq), arg = s.substr(eq + 1);
+
+  char* end;
+  trigger->value = strtoull(arg.c_str(), &end, 0);
+  bool number = *end == 0;
+  trigger->symbol.clear();
+
+  if (kind == "pc") {
+    trigger->type = log_trigger_t::PC;
+    if (!number)
+      trigger->symbol = arg;
+  } else if (kind == "insn" && number) {
+    trigger->type = log_trigger_t::INSTRET;
+  } else if (kind == "csr") {
+    trigger->type = log_trigger_t::CSR;
+    if (!number) {
+      #define DECLARE_CSR(name, num) if (arg == #name) { trigger->value = num; return true; }
+      #include "encoding.h"
+      #undef DECLARE_CSR
+      return false;
+    }
+  } else if (kind == "marker" && number) {
+    trigger->type = log_trigger_t::MARKER;
+  } else {
+    return false;
+  }
+  return true;
 }
-#endif
 
 void processor_t::reset()
 {
@@ -460,6 +549,8 @@ void processor_t::reset()
     set_csr(CSR_PMPCFG0, PMP_R | PMP_W | PMP_X | PMP_NAPOT);
   }
 
+  mmu->flush_tlb_l2();
+
   if (ext)
     ext->reset(); // reset the extension
 
@@ -467,6 +558,76 @@ void processor_t::reset()
     sim->proc_reset(id);
 }
 
+void processor_t::checkpoint(checkpoint_t& c)
+{
+  // the debug module's state isn't saved, so it has to be idle
+  if (c.saving() && state.debug_mode)
+    throw std::runtime_error("can't checkpoint a hart in debug mode");
+
+  c.tag("hart");
+  c.match(id, "hart ID");
+  c.match(max_isa, "ISA");
+  c.match(VU.VLEN, "VLEN");
+
+  c.io(state.pc);
+  c.io(state.XPR);
+  c.io(state.FPR);
+  c.io(state.prv);
+  c.io(state.misa);
+  c.io(state.mstatus);
+  c.io(state.mepc);
+  c.io(state.mtval);
+  c.io(state.mscratch);
+  c.io(state.mtvec);
+  c.io(state.mcause);
+  c.io(state.minstret);
+  c.io(state.mie);
+  c.io(state.mip);
+  c.io(state.medeleg);
+  c.io(state.mideleg);
+  c.io(state.mcounteren);
+  c.io(state.scounteren);
+  c.io(state.sepc);
+  c.io(state.stval);
+  c.io(state.sscratch);
+  c.io(state.stvec);
+  c.io(state.satp);
+  c.io(state.scause);
+  c.io(state.dpc);
+  c.io(state.dscratch0);
+  c.io(state.dscratch1);
+  c.io(state.dcsr);
+  c.io(state.tselect);
+  c.io(state.mcontrol);
+  c.io(state.tdata2);
+  c.io(state.pmpcfg);
+  c.io(state.pmpaddr);
+  c.io(state.fflags);
+  c.io(state.frm);
+  c.io(state.serialized);
+  c.io(state.single_step);
+
+  c.bytes(VU.reg_file, NVPR * (VU.VLEN / 8));
+  c.io(VU.vstart);
+  c.io(VU.vxrm);
+  c.io(VU.vxsat);
+  c.io(VU.vl);
+  c.io(VU.vtype);
+  c.io(VU.vlmax);
+  c.io(VU.vma);
+  c.io(VU.vta);
+  c.io(VU.vediv);
+  c.io(VU.vsew);
+  c.io(VU.vflmul);
+  c.io(VU.vill);
+
+  if (!c.saving()) {
+    trigger_updated(); // also flushes the TLB
+    mmu->flush_tlb_l2();
+    mmu->yield_load_reservation();
+  }
+}
+
 // Count number of contiguous 0 bits starting from the LSB.
 static int ctz(reg_t val)
 {
@@ -632,6 +793,9 @@ void processor_t::take_trap(trap_t& t, reg_t epc)
     set_csr(CSR_MSTATUS, s);
     set_privilege(PRV_M);
   }
+
+  if (unlikely(callgraph != NULL))
+    callgraph->trap(state.prv, state.satp, state.pc);
 }
 
 void processor_t::disasm(insn_t insn)
@@ -658,6 +822,13 @@ int processor_t::paddr_bits()
   return max_xlen == 64 ? 50 : 34;
 }
 
+void processor_t::set_csr_from_insn(int which, reg_t val)
+{
+  if (unlikely(log_trigger.type == log_trigger_t::CSR && which == (int)log_trigger.value))
+    toggle_log_window();
+  set_csr(which, val);
+}
+
 void processor_t::set_csr(int which, reg_t val)
 {
   val = zext_xlen(val);
@@ -680,6 +851,7 @@ void processor_t::set_csr(int which, reg_t val)
       state.pmpaddr[i] = val & ((reg_t(1) << (MAX_PADDR_BITS - PMP_SHIFT)) - 1);
 
     mmu->flush_tlb();
+    mmu->flush_tlb_l2();
   }
 
   if (which >= CSR_PMPCFG0 && which < CSR_PMPCFG0 + state.max_pmp / 4) {
@@ -696,6 +868,7 @@ void processor_t::set_csr(int which, reg_t val)
       }
     }
     mmu->flush_tlb();
+    mmu->flush_tlb_l2();
   }
 
   switch (which)
@@ -758,8 +931,12 @@ void processor_t::set_csr(int which, reg_t val)
       break;
     }
     case CSR_MIP: {
+      // update atomically, since other harts may post an MSIP concurrently
       reg_t mask = supervisor_ints & (MIP_SSIP | MIP_STIP);
-      state.mip = (state.mip & ~mask) | (val & mask);
+      reg_t mip = __atomic_load_n(&state.mip, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(&state.mip, &mip, (mip & ~mask) | (val & mask),
+                                          true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
       break;
     }
     case CSR_MIE:
@@ -819,11 +996,11 @@ void processor_t::set_csr(int which, reg_t val)
       reg_t rv64_ppn_mask = (reg_t(1) << (MAX_PADDR_BITS - PGSHIFT)) - 1;
       mmu->flush_tlb();
       if (max_xlen == 32)
-        state.satp = val & (SATP32_PPN | SATP32_MODE);
+        state.satp = val & (SATP32_PPN | SATP32_ASID | SATP32_MODE);
       if (max_xlen == 64 && (get_field(val, SATP64_MODE) == SATP_MODE_OFF ||
                              get_field(val, SATP64_MODE) == SATP_MODE_SV39 ||
                              get_field(val, SATP64_MODE) == SATP_MODE_SV48))
-        state.satp = val & (SATP64_PPN | SATP64_MODE | rv64_ppn_mask);
+        state.satp = val & (SATP64_PPN | SATP64_ASID | SATP64_MODE | rv64_ppn_mask);
       break;
     }
     case CSR_SEPC: state.sepc = val & ~(reg_t)1; break;
@@ -853,7 +1030,11 @@ void processor_t::set_csr(int which, reg_t val)
       mask |= 1L << ('C' - 'A');
       mask &= max_isa;
 
+      reg_t old_misa = state.misa;
       state.misa = (val & mask) | (state.misa & ~mask);
+      // translated code assumes the extensions it uses are enabled
+      if (state.misa != old_misa)
+        mmu->flush_icache();
       break;
     }
     case CSR_TSELECT:
@@ -1184,6 +1365,8 @@ insn_func_t processor_t::decode_insn(insn_t insn)
     opcode_cache[idx].match = insn.bits();
   }
 
+  if (unlikely(log_commits_enabled) && desc.logged_rv32)
+    return xlen == 64 ? desc.logged_rv64 : desc.logged_rv32;
   return xlen == 64 ? desc.rv64 : desc.rv32;
 }
 
@@ -1204,7 +1387,7 @@ void processor_t::build_opcode_map()
   std::sort(instructions.begin(), instructions.end(), cmp());
 
   for (size_t i = 0; i < OPCODE_CACHE_SIZE; i++)
-    opcode_cache[i] = {0, 0, &illegal_instruction, &illegal_instruction};
+    opcode_cache[i] = {0, 0, &illegal_instruction, &illegal_instruction, NULL, NULL};
 }
 
 void processor_t::register_extension(extension_t* x)
@@ -1231,7 +1414,7 @@ void processor_t::register_base_instructions()
   #include "insn_list.h"
   #undef DEFINE_INSN
 
-  register_insn({0, 0, &illegal_instruction, &illegal_instruction});
+  register_insn({0, 0, &illegal_instruction, &illegal_instruction, NULL, NULL});
   build_opcode_map();
 }
 
@@ -8,6 +8,7 @@
 #include "trap.h"
 #include <string>
 #include <vector>
+#include <functional>
 #include <unordered_map>
 #include <map>
 #include <cassert>
@@ -20,6 +21,11 @@ class simif_t;
 class trap_t;
 class extension_t;
 class disassembler_t;
+class checkpoint_t;
+class bbv_t;
+class profiler_t;
+class callgraph_t;
+class commit_trace_t;
 
 struct insn_desc_t
 {
@@ -27,6 +33,10 @@ struct insn_desc_t
   insn_bits_t mask;
   insn_func_t rv32;
   insn_func_t rv64;
+  // variants that log commits, if the functions above don't check for
+  // themselves (see LOG_COMMITS in decode.h)
+  insn_func_t logged_rv32;
+  insn_func_t logged_rv64;
 };
 
 // regnum, data
@@ -209,14 +219,12 @@ struct state_t
       STEP_STEPPED
   } single_step;
 
-#ifdef RISCV_ENABLE_COMMITLOG
   commit_log_reg_t log_reg_write;
   commit_log_mem_t log_mem_read;
   commit_log_mem_t log_mem_write;
   reg_t last_inst_priv;
   int last_inst_xlen;
   int last_inst_flen;
-#endif
 };
 
 typedef enum {
@@ -234,6 +242,19 @@ typedef enum {
   EXT_ZVQMAC,
 } isa_extension_t;
 
+// a condition that opens or closes a window of logging (see
+// processor_t::set_log_window)
+struct log_trigger_t
+{
+  enum { NONE, PC, INSTRET, CSR, MARKER } type;
+  reg_t value; // the PC, minstret, CSR number, or marker
+  std::string symbol; // names the PC, until it is looked up
+};
+
+// parses pc=<address or symbol>, insn=<n>, csr=<name or number> or
+// marker=<n>
+bool parse_log_trigger(const std::string& s, log_trigger_t* trigger);
+
 // Count number of contiguous 1 bits starting from the LSB.
 static int cto(reg_t val)
 {
@@ -253,14 +274,50 @@ public:
   ~processor_t();
 
   void set_debug(bool value);
-  void set_histogram(bool value);
-#ifdef RISCV_ENABLE_COMMITLOG
-  void enable_log_commits();
+  // count the instructions run in each basic block
+  void set_profiling(bool value);
+  profiler_t* get_profiler() { return profiler; }
+  // track the call stack, counting instructions by it
+  void set_callgraph(bool value);
+  callgraph_t* get_callgraph() { return callgraph; }
+  // write basic-block vectors to path every interval instructions
+  void set_bbv(const std::string& path, uint64_t interval);
+  bbv_t* get_bbv() { return bbv; }
+  // Commit logging can be turned on and off at any time. While it is on,
+  // instructions run on the slow path, decoded to their logging variants.
+  void set_log_commits(bool value);
   bool get_log_commits_enabled() const { return log_commits_enabled; }
-#endif
+  // do F/D/V add, subtract, multiply and divide on the host FPU when they
+  // round to nearest-even (see host_fp.h)
+  void set_host_fp(bool value) { host_fp = value; }
+  bool get_host_fp() const { return host_fp; }
+  // log commits to trace, as its hart index, rather than as text
+  void set_commit_trace(commit_trace_t* trace, size_t index);
+  commit_trace_t* get_commit_trace() { return commit_trace; }
+  size_t get_commit_trace_index() const { return commit_trace_index; }
+  // Only log (instructions if log, commits if log_commits) in windows that
+  // open when start is met and close when stop is met; with no start, the
+  // window opens at once, and with no stop, it stays open. Only the armed
+  // trigger is checked: a PC where a block starts (blocks end before it), a
+  // CSR when it is written, an instruction count between steps, and a
+  // marker by the simulator.
+  void set_log_window(const log_trigger_t& start, const log_trigger_t& stop,
+                      bool log, bool log_commits);
+  // open or close the window, arming the other trigger
+  void toggle_log_window();
+  const log_trigger_t& get_log_trigger() const { return log_trigger; }
+  // Make step() return at the first block boundary where cond() holds,
+  // before the block runs; blocks also end before pc (unless it is -1), so
+  // that a condition on it is checked there. For run-until in the debugger.
+  void set_stop_condition(std::function<bool()> cond, reg_t pc = -1);
   void reset();
-  void step(size_t n); // run for n cycles
+  // run for n cycles; returns n, or fewer if the stop condition ended
+  // the step early
+  size_t step(size_t n);
   void set_csr(int which, reg_t val);
+  // set_csr for the CSR instructions, whose writes can open or close a
+  // logging window; the simulator's own writes (on traps, say) don't
+  void set_csr_from_insn(int which, reg_t val);
   reg_t get_csr(int which);
   mmu_t* get_mmu() { return mmu; }
   state_t* get_state() { return &state; }
@@ -288,7 +345,6 @@ public:
   }
   reg_t legalize_privilege(reg_t);
   void set_privilege(reg_t);
-  void update_histogram(reg_t pc);
   const disassembler_t* get_disassembler() { return disassembler; }
 
   FILE *get_log_file() { return log_file; }
@@ -396,6 +452,9 @@ public:
   void set_pmp_num(reg_t pmp_num);
   void set_pmp_granularity(reg_t pmp_granularity);
 
+  // save or restore the architectural state
+  void checkpoint(checkpoint_t& c);
+
 private:
   simif_t* sim;
   mmu_t* mmu; // main memory is always accessed via the mmu
@@ -407,15 +466,28 @@ private:
   unsigned xlen;
   reg_t max_isa;
   std::string isa_string;
-  bool histogram_enabled;
+  profiler_t* profiler;
+  callgraph_t* callgraph;
+  bbv_t* bbv;
   bool log_commits_enabled;
+  bool host_fp;
+  commit_trace_t* commit_trace;
+  size_t commit_trace_index;
+  log_trigger_t log_start;
+  log_trigger_t log_stop;
+  log_trigger_t log_trigger; // the armed one
+  reg_t log_trigger_pc; // if it is a PC, else -1
+  bool log_window_open;
+  bool log_window_log;
+  bool log_window_commits;
+  std::function<bool()> stop_condition;
+  reg_t stop_pc;
   FILE *log_file;
   bool halt_on_reset;
   std::vector<bool> extension_table;
   
 
   std::vector<insn_desc_t> instructions;
-  std::map<reg_t,uint64_t> pc_histogram;
 
   static const size_t OPCODE_CACHE_SIZE = 8191;
   insn_desc_t opcode_cache[OPCODE_CACHE_SIZE];
@@ -451,7 +523,6 @@ public:
     public:
       processor_t* p;
       void *reg_file;
-      char reg_referenced[NVPR];
       int setvl_count;
       reg_t vlmax;
       reg_t vstart, vxrm, vxsat, vl, vtype, vlenb;
@@ -462,30 +533,34 @@ public:
       float vflmul;
       reg_t vmel;
       reg_t ELEN, VLEN, SLEN;
+      reg_t lg_vlenb;
       bool vill;
 
-      // vector element for varies SEW
+      // vector element for varies SEW. a register group is contiguous in
+      // reg_file, so element n of vReg is element n % elts_per_reg of
+      // vReg + n / elts_per_reg without dividing
       template<class T>
         T& elt(reg_t vReg, reg_t n, bool is_write = false){
           assert(vsew != 0);
           assert((VLEN >> 3)/sizeof(T) > 0);
-          reg_t elts_per_reg = (VLEN >> 3) / (sizeof(T));
-          vReg += n / elts_per_reg;
-          n = n % elts_per_reg;
+          const reg_t lg_elts_per_reg = lg_vlenb - __builtin_ctz(sizeof(T));
 #ifdef WORDS_BIGENDIAN
           // "V" spec 0.7.1 requires lower indices to map to lower significant
           // bits when changing SEW, thus we need to index from the end on BE.
-  	  n ^= elts_per_reg - 1;
+          n ^= (reg_t(1) << lg_elts_per_reg) - 1;
 #endif
-          reg_referenced[vReg] = 1;
 
-#ifdef RISCV_ENABLE_COMMITLOG
-          if (is_write)
-            p->get_state()->log_reg_write[((vReg) << 2) | 2] = {0, 0};
-#endif
+          if (is_write && p->get_log_commits_enabled())
+            p->get_state()->log_reg_write[((vReg + (n >> lg_elts_per_reg)) << 2) | 2] = {0, 0};
 
-          T *regStart = (T*)((char*)reg_file + vReg * (VLEN >> 3));
-          return regStart[n];
+          return elt_group<T>(vReg)[n];
+        }
+
+      // the elements of the register group starting at vReg, in order on
+      // little-endian hosts; for loops that run over whole groups
+      template<class T>
+        T* elt_group(reg_t vReg){
+          return (T*)((char*)reg_file + (vReg << lg_vlenb));
         }
     public:
 
@@ -519,6 +594,9 @@ reg_t illegal_instruction(processor_t* p, insn_t insn, reg_t pc);
 #define REGISTER_INSN(proc, name, match, mask) \
   extern reg_t rv32_##name(processor_t*, insn_t, reg_t); \
   extern reg_t rv64_##name(processor_t*, insn_t, reg_t); \
-  proc->register_insn((insn_desc_t){match, mask, rv32_##name, rv64_##name});
+  extern reg_t logged_rv32_##name(processor_t*, insn_t, reg_t); \
+  extern reg_t logged_rv64_##name(processor_t*, insn_t, reg_t); \
+  proc->register_insn((insn_desc_t){match, mask, rv32_##name, rv64_##name, \
+                                    logged_rv32_##name, logged_rv64_##name});
 
 #endif
@@ -0,0 +1,123 @@
+// See LICENSE for license details.
+
+#include "profile.h"
+#include <algorithm>
+
+void profiler_t::merge_into(std::map<reg_t, uint64_t>& out) const
+{
+  blocks.for_each([&](reg_t pc, uint64_t count) {
+    if (count)
+      out[pc] += count;
+  });
+}
+
+std::string symbolize(reg_t pc, const std::map<reg_t, std::string>& symbols)
+{
+  auto sym = symbols.upper_bound(pc);
+  if (sym != symbols.begin())
+    return std::prev(sym)->second;
+
+  char addr[32];
+  snprintf(addr, sizeof(addr), "0x%" PRIx64, pc);
+  return addr;
+}
+
+bool parse_profile_format(const std::string& name, profile_format_t* format)
+{
+  static const std::map<std::string, profile_format_t> formats = {
+    {"histogram", PROFILE_HISTOGRAM},
+    {"csv", PROFILE_CSV},
+    {"collapsed", PROFILE_COLLAPSED},
+    {"pprof", PROFILE_PPROF},
+  };
+
+  auto it = formats.find(name);
+  if (it == formats.end())
+    return false;
+  *format = it->second;
+  return true;
+}
+
+static void write_histogram(FILE* out, const std::map<reg_t, uint64_t>& blocks)
+{
+  fprintf(out, "PC Histogram size:%zu\n", blocks.size());
+  for (auto& b : blocks)
+    fprintf(out, "%0" PRIx64 " %" PRIu64 "\n", b.first, b.second);
+}
+
+static void write_functions(FILE* out, profile_format_t format,
+                            const std::map<reg_t, uint64_t>& blocks,
+                            const std::map<reg_t, std::string>& symbols)
+{
+  // instructions by function, keyed by the function's address
+  std::map<reg_t, uint64_t> functions;
+  uint64_t unknown = 0;
+  for (auto& b : blocks) {
+    auto sym = symbols.upper_bound(b.first);
+    if (sym == symbols.begin())
+      unknown += b.second;
+    else
+      functions[std::prev(sym)->first] += b.second;
+  }
+
+  std::vector<std::pair<uint64_t, reg_t>> sorted;
+  for (auto& f : functions)
+    sorted.emplace_back(f.second, f.first);
+  std::sort(sorted.rbegin(), sorted.rend());
+
+  if (format == PROFILE_CSV)
+    fprintf(out, "function,address,instructions\n");
+  for (auto& f : sorted) {
+    if (format == PROFILE_CSV)
+      fprintf(out, "%s,0x%" PRIx64 ",%" PRIu64 "\n",
+              symbols.at(f.second).c_str(), f.second, f.first);
+    else
+      fprintf(out, "%s %" PRIu64 "\n", symbols.at(f.second).c_str(), f.first);
+  }
+  if (unknown) {
+    if (format == PROFILE_CSV)
+      fprintf(out, "[unknown],,%" PRIu64 "\n", unknown);
+    else
+      fprintf(out, "[unknown] %" PRIu64 "\n", unknown);
+  }
+}
+
+// The legacy CPU profile format of gperftools: a header, then one record of
+// (count, depth, pcs...) per sample, then a trailer and the mapped objects
+// in the form of /proc/self/maps. Every block is a sample of depth one.
+static void write_pprof(FILE* out, const std::map<reg_t, uint64_t>& blocks,
+                        const std::string& elf)
+{
+  std::vector<uint64_t> words = {0, 3, 0, 1, 0};
+  for (auto& b : blocks) {
+    words.push_back(b.second);
+    words.push_back(1);
+    words.push_back(b.first);
+  }
+  words.push_back(0);
+  words.push_back(1);
+  words.push_back(0);
+  fwrite(words.data(), sizeof(uint64_t), words.size(), out);
+
+  fprintf(out, "%016" PRIx64 "-%016" PRIx64 " r-xp 00000000 00:00 0 %s\n",
+          uint64_t(0), UINT64_MAX, elf.c_str());
+}
+
+void write_profile(FILE* out, profile_format_t format,
+                   const std::map<reg_t, uint64_t>& blocks,
+                   const std::map<reg_t, std::string>& symbols,
+                   const std::string& elf)
+{
+  switch (format) {
+    case PROFILE_HISTOGRAM:
+      write_histogram(out, blocks);
+      break;
+    case PROFILE_CSV:
+    case PROFILE_COLLAPSED:
+      write_functions(out, format, blocks, symbols);
+      break;
+    case PROFILE_PPROF:
+      write_pprof(out, blocks, elf);
+      break;
+  }
+}
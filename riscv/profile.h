@@ -0,0 +1,55 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_PROFILE_H
+#define _RISCV_PROFILE_H
+
+#include "decode.h"
+#include "block_counters.h"
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <vector>
+
+// Instruction counts by basic block, keyed by the block's first PC.
+class profiler_t
+{
+public:
+  // the counter for the block starting at pc, which stays valid
+  uint64_t* counter(reg_t pc) { return blocks.counter(pc); }
+
+  // for instructions that run outside the block cache
+  void add(reg_t pc, uint64_t insns) { *counter(pc) += insns; }
+
+  // the blocks that have run, with their instruction counts
+  void merge_into(std::map<reg_t, uint64_t>& out) const;
+
+private:
+  block_counters_t blocks;
+};
+
+// Profile output formats:
+//   histogram: instructions per block, in the old -g format
+//   csv:       instructions per function, as function,address,instructions
+//   collapsed: instructions per function, for flamegraph.pl
+//   pprof:     instructions per block, as a gperftools CPU profile whose
+//              samples are instructions; pprof symbolizes it from the ELF
+enum profile_format_t {
+  PROFILE_HISTOGRAM,
+  PROFILE_CSV,
+  PROFILE_COLLAPSED,
+  PROFILE_PPROF,
+};
+
+// the name of the function at pc, or its address if it has no symbol
+std::string symbolize(reg_t pc, const std::map<reg_t, std::string>& symbols);
+
+bool parse_profile_format(const std::string& name, profile_format_t* format);
+
+// Functions are found from symbols, by address, as the closest one at or
+// below each block; elf is the program they came from.
+void write_profile(FILE* out, profile_format_t format,
+                   const std::map<reg_t, uint64_t>& blocks,
+                   const std::map<reg_t, std::string>& symbols,
+                   const std::string& elf);
+
+#endif
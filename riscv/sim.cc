@@ -5,7 +5,13 @@
 #include "dts.h"
 #include "remote_bitbang.h"
 #include "byteorder.h"
+#include "checkpoint.h"
+#include "cachesim.h"
+#include "bbv.h"
+#include "callgraph.h"
+#include "commit_trace.h"
 #include <fstream>
+#include <algorithm>
 #include <map>
 #include <iostream>
 #include <sstream>
@@ -26,6 +32,12 @@ static void handle_signal(int sig)
   signal(sig, &handle_signal);
 }
 
+static volatile bool profile_requested = false;
+static void handle_profile_signal(int sig)
+{
+  profile_requested = true;
+}
+
 sim_t::sim_t(const char* isa, const char* priv, const char* varch,
              size_t nprocs, bool halted, bool real_time_clint,
              reg_t initrd_start, reg_t initrd_end,
@@ -49,9 +61,22 @@ sim_t::sim_t(const char* isa, const char* priv, const char* varch,
     current_step(0),
     current_proc(0),
     debug(false),
-    histogram_enabled(false),
     log(false),
+    log_commits(false),
+    log_windowed(false),
     remote_bitbang(NULL),
+    parallel(false),
+    sync_quantum(INTERLEAVE),
+    rtc_residue(0),
+    quantum_epoch(0),
+    workers_busy(0),
+    workers_exit(false),
+    hart_steps(0),
+    checkpoint_insns(0),
+    fork_insns(0),
+    sample_phase(SAMPLE_OFF),
+    profile_enabled(false),
+    profile_format(PROFILE_HISTOGRAM),
     debug_module(this, dm_config)
 {
   signal(SIGINT, &handle_signal);
@@ -102,6 +127,7 @@ sim_t::sim_t(const char* isa, const char* priv, const char* varch,
 
 sim_t::~sim_t()
 {
+  stop_workers();
   for (size_t i = 0; i < procs.size(); i++)
     delete procs[i];
   delete debug_mmu;
@@ -114,18 +140,43 @@ void sim_thread_main(void* arg)
 
 void sim_t::main()
 {
-  if (!debug && log)
+  if (log_windowed)
+    start_log_windows();
+  else if (!debug && log)
     set_procs_debug(true);
+  if (sample_phase != SAMPLE_OFF)
+    sample_step();
 
   while (!done())
   {
     if (debug || ctrlc_pressed)
       interactive();
+    else if (parallel)
+      step_parallel();
     else
       step(INTERLEAVE);
     if (remote_bitbang) {
       remote_bitbang->tick();
     }
+    if (current_step != 0 || current_proc != 0)
+      continue;
+    if (sample_phase != SAMPLE_OFF)
+      sample_step();
+    if (profile_requested) {
+      profile_requested = false;
+      write_profile();
+    }
+    if (fork_insns && hart_steps >= fork_insns) {
+      fork_insns = 0;
+      if (fan_out() == 0)
+        host->switch_to();
+    }
+    if (!checkpoint_path.empty() && hart_steps >= checkpoint_insns) {
+      checkpoint_or_die(checkpoint_path, true);
+      checkpoint_path.clear();
+      request_exit(0);
+      host->switch_to();
+    }
   }
 }
 
@@ -141,7 +192,14 @@ void sim_t::step(size_t n)
   for (size_t i = 0, steps = 0; i < n; i += steps)
   {
     steps = std::min(n - i, INTERLEAVE - current_step);
-    procs[current_proc]->step(steps);
+    size_t ran = procs[current_proc]->step(steps);
+
+    // a debugger stop condition holds: leave the rest of the turn, and the
+    // host, until stepping resumes
+    if (ran < steps) {
+      current_step += ran;
+      return;
+    }
 
     current_step += steps;
     if (current_step == INTERLEAVE)
@@ -150,6 +208,7 @@ void sim_t::step(size_t n)
       procs[current_proc]->get_mmu()->yield_load_reservation();
       if (++current_proc == procs.size()) {
         current_proc = 0;
+        hart_steps += INTERLEAVE;
         clint->increment(INTERLEAVE / INSNS_PER_RTC_TICK);
       }
 
@@ -158,37 +217,383 @@ void sim_t::step(size_t n)
   }
 }
 
+void sim_t::step_parallel()
+{
+  if (workers.empty()) {
+    for (size_t i = 1; i < procs.size(); i++)
+      workers.emplace_back(&sim_t::worker_main, this, i);
+  }
+
+  // release the workers, then run processor 0 on this thread
+  workers_busy = workers.size();
+  {
+    std::lock_guard<std::mutex> lock(worker_lock);
+    quantum_epoch++;
+  }
+  worker_start.notify_all();
+
+  procs[0]->step(sync_quantum);
+
+  for (size_t spins = 0; workers_busy != 0 && spins < WORKER_SPINS; spins++)
+    std::this_thread::yield();
+  if (workers_busy != 0) {
+    std::unique_lock<std::mutex> lock(worker_lock);
+    worker_done.wait(lock, [&]{ return workers_busy == 0; });
+  }
+
+  // all processors are stopped, so shared state can be updated safely
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->get_mmu()->yield_load_reservation();
+  hart_steps += sync_quantum;
+  rtc_residue += sync_quantum;
+  clint->increment(rtc_residue / INSNS_PER_RTC_TICK);
+  rtc_residue %= INSNS_PER_RTC_TICK;
+
+  host->switch_to();
+}
+
+void sim_t::worker_main(size_t id)
+{
+  uint64_t epoch = 0;
+  while (true) {
+    for (size_t spins = 0; quantum_epoch == epoch && spins < WORKER_SPINS; spins++)
+      std::this_thread::yield();
+    if (quantum_epoch == epoch) {
+      std::unique_lock<std::mutex> lock(worker_lock);
+      worker_start.wait(lock, [&]{ return quantum_epoch != epoch; });
+    }
+    epoch = quantum_epoch;
+
+    if (workers_exit)
+      return;
+
+    procs[id]->step(sync_quantum);
+
+    if (--workers_busy == 0) {
+      std::lock_guard<std::mutex> lock(worker_lock);
+      worker_done.notify_one();
+    }
+  }
+}
+
+void sim_t::stop_workers()
+{
+  {
+    std::lock_guard<std::mutex> lock(worker_lock);
+    workers_exit = true;
+    quantum_epoch++;
+  }
+  worker_start.notify_all();
+
+  for (auto& t : workers)
+    t.join();
+  workers.clear();
+  workers_exit = false;
+}
+
+void sim_t::set_checkpoint(uint64_t insns, const char* path)
+{
+  checkpoint_insns = insns;
+  checkpoint_path = path;
+}
+
+void sim_t::set_restore(const char* path)
+{
+  restore_path = path;
+}
+
+void sim_t::configure_sampling(const std::vector<sample_window_t>& windows,
+                               uint64_t period, uint64_t warmup,
+                               const std::vector<cache_sim_t*>& caches)
+{
+  sample_windows = windows;
+  sample_index = 0;
+  sample_period = period;
+  sample_warmup = warmup;
+  sample_caches = caches;
+  sample_phase = windows.empty() ? SAMPLE_OFF : SAMPLE_FAST;
+  sample_next = windows.empty() ? 0 :
+                windows[0].start - std::min(windows[0].start, warmup);
+  set_tracing(false);
+}
+
+void sim_t::set_tracing(bool enabled)
+{
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->get_mmu()->set_tracing(enabled);
+}
+
+void sim_t::print_sample(const char* what)
+{
+  std::cout << "Sample " << what << " " << sample_index << ": instructions "
+            << sample_begin << "-" << hart_steps << std::endl;
+  for (auto c : sample_caches) {
+    c->print_stats();
+    c->clear_stats();
+  }
+}
+
+// Phase changes happen between steps, so windows are rounded to whole
+// interleave steps.
+void sim_t::sample_step()
+{
+  while (sample_phase != SAMPLE_OFF && hart_steps >= sample_next) {
+    switch (sample_phase) {
+      case SAMPLE_FAST:
+        set_tracing(true);
+        sample_phase = SAMPLE_WARM;
+        sample_next = sample_windows[sample_index].start;
+        break;
+      case SAMPLE_WARM:
+        for (auto c : sample_caches)
+          c->clear_stats();
+        sample_begin = hart_steps;
+        sample_phase = SAMPLE_DETAIL;
+        sample_next = sample_windows[sample_index].start +
+                      sample_windows[sample_index].length;
+        break;
+      case SAMPLE_DETAIL:
+        print_sample("window");
+        set_tracing(false);
+        sample_phase = SAMPLE_FAST;
+        if (++sample_index == sample_windows.size()) {
+          if (sample_period == 0) {
+            sample_phase = SAMPLE_OFF;
+            break;
+          }
+          sample_window_t w = sample_windows.back();
+          w.start += sample_period;
+          sample_windows.push_back(w);
+        }
+        sample_next = sample_windows[sample_index].start -
+                      std::min(sample_windows[sample_index].start, sample_warmup);
+        break;
+      case SAMPLE_OFF:
+        break;
+    }
+  }
+}
+
+void sim_t::finish_sampling()
+{
+  if (sample_phase == SAMPLE_DETAIL)
+    print_sample("partial window");
+  for (auto c : sample_caches)
+    c->clear_stats();
+  sample_phase = SAMPLE_OFF;
+}
+
+void sim_t::checkpoint(checkpoint_t& c)
+{
+  c.tag("sim");
+  c.match(uint64_t(procs.size()), "number of processors");
+  c.io(current_step);
+  c.io(current_proc);
+  c.io(rtc_residue);
+  c.io(hart_steps);
+
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->checkpoint(c);
+  clint->checkpoint(c);
+
+  for (auto& x : mems) {
+    c.tag("mem");
+    c.match(uint64_t(x.first), "memory layout");
+    c.memory(x.second->contents(), x.second->size());
+  }
+  c.tag("end");
+}
+
+void sim_t::checkpoint_or_die(const std::string& path, bool saving)
+{
+  try {
+    checkpoint_t c(path, saving);
+    checkpoint(c);
+  } catch (std::runtime_error& e) {
+    fprintf(stderr, "%s checkpoint failed: %s\n",
+            saving ? "saving" : "restoring", e.what());
+    exit(1);
+  }
+}
+
 void sim_t::set_debug(bool value)
 {
   debug = value;
 }
 
-void sim_t::set_histogram(bool value)
+void sim_t::configure_profile(profile_format_t format, const std::string& path)
+{
+  profile_enabled = true;
+  profile_format = format;
+  profile_path = path;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_profiling(true);
+  signal(SIGUSR1, &handle_profile_signal);
+}
+
+void sim_t::configure_callgraph(const std::string& path)
+{
+  callgraph_path = path;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_callgraph(true);
+  signal(SIGUSR1, &handle_profile_signal);
+}
+
+void sim_t::write_profile()
+{
+  if (profile_enabled) {
+    std::map<reg_t, uint64_t> blocks;
+    for (size_t i = 0; i < procs.size(); i++)
+      procs[i]->get_profiler()->merge_into(blocks);
+
+    FILE* out = stderr;
+    if (!profile_path.empty() && !(out = fopen(profile_path.c_str(), "w"))) {
+      fprintf(stderr, "couldn't open %s\n", profile_path.c_str());
+    } else {
+      ::write_profile(out, profile_format, blocks, symbols, program_path);
+      if (out != stderr)
+        fclose(out);
+    }
+  }
+
+  if (!callgraph_path.empty()) {
+    std::map<std::string, uint64_t> stacks;
+    for (size_t i = 0; i < procs.size(); i++)
+      procs[i]->get_callgraph()->fold_into(stacks, symbols);
+
+    FILE* out = fopen(callgraph_path.c_str(), "w");
+    if (!out) {
+      fprintf(stderr, "couldn't open %s\n", callgraph_path.c_str());
+    } else {
+      for (auto& s : stacks)
+        fprintf(out, "%s %" PRIu64 "\n", s.first.c_str(), s.second);
+      fclose(out);
+    }
+  }
+}
+
+std::map<std::string, uint64_t> sim_t::load_payload(const std::string& payload, reg_t* entry)
+{
+  auto payload_symbols = htif_t::load_payload(payload, entry);
+  if (program_path.empty())
+    program_path = payload;
+
+  // keep the names that can label code: not section or mapping symbols
+  for (auto& s : payload_symbols) {
+    if (!s.first.empty() && s.first[0] != '$') {
+      symbols.emplace(s.second, s.first);
+      symbol_addrs.emplace(s.first, s.second);
+    }
+  }
+
+  return payload_symbols;
+}
+
+void sim_t::set_jit(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->get_mmu()->set_jit(value);
+  }
+}
+
+void sim_t::set_host_fp(bool value)
 {
-  histogram_enabled = value;
   for (size_t i = 0; i < procs.size(); i++) {
-    procs[i]->set_histogram(histogram_enabled);
+    procs[i]->set_host_fp(value);
   }
 }
 
 void sim_t::configure_log(bool enable_log, bool enable_commitlog)
 {
   log = enable_log;
+  log_commits = enable_commitlog;
 
-  if (!enable_commitlog)
-    return;
-
-#ifndef RISCV_ENABLE_COMMITLOG
-  fputs("Commit logging support has not been properly enabled; "
-        "please re-build the riscv-isa-sim project using "
-        "\"configure --enable-commitlog\".\n",
-        stderr);
-  abort();
-#else
   for (processor_t *proc : procs) {
-    proc->enable_log_commits();
+    proc->set_log_commits(enable_commitlog);
+  }
+}
+
+void sim_t::set_commit_trace(const std::string& path)
+{
+  commit_trace_path = path;
+  try {
+    commit_trace.reset(new commit_trace_t(path));
+  } catch (std::runtime_error& e) {
+    fprintf(stderr, "couldn't open %s\n", e.what());
+    exit(1);
+  }
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_commit_trace(commit_trace.get(), i);
+}
+
+void sim_t::configure_log_window(const log_trigger_t& start, const log_trigger_t& stop)
+{
+  log_windowed = true;
+  log_start = start;
+  log_stop = stop;
+}
+
+void sim_t::start_log_windows()
+{
+  for (log_trigger_t* t : {&log_start, &log_stop}) {
+    if (t->symbol.empty())
+      continue;
+    auto it = symbol_addrs.find(t->symbol);
+    if (it == symbol_addrs.end()) {
+      fprintf(stderr, "couldn't find symbol %s\n", t->symbol.c_str());
+      exit(1);
+    }
+    t->value = it->second;
+  }
+
+  if (log_start.type == log_trigger_t::PC && log_stop.type == log_trigger_t::PC &&
+      log_start.value == log_stop.value) {
+    fprintf(stderr, "a logging window can't start and stop at the same PC\n");
+    exit(1);
+  }
+
+  for (processor_t* proc : procs)
+    proc->set_log_window(log_start, log_stop, log, log_commits);
+}
+
+void sim_t::mark(uint64_t value)
+{
+  for (processor_t* proc : procs) {
+    const log_trigger_t& trigger = proc->get_log_trigger();
+    if (trigger.type == log_trigger_t::MARKER && trigger.value == value)
+      proc->toggle_log_window();
   }
-#endif
+}
+
+void sim_t::prepare_to_fork()
+{
+  stop_workers();
+  if (commit_trace)
+    commit_trace->stop();
+}
+
+void sim_t::after_fork(size_t child)
+{
+  std::string suffix = "." + std::to_string(child);
+  if (commit_trace)
+    commit_trace->reopen(commit_trace_path + suffix);
+  // the parent writes its own profile, of the run up to the fork
+  if (!profile_path.empty())
+    profile_path += suffix;
+  if (!callgraph_path.empty())
+    callgraph_path += suffix;
+  for (processor_t* proc : procs)
+    if (bbv_t* bbv = proc->get_bbv())
+      bbv->reopen(bbv->get_path() + suffix);
+}
+
+void sim_t::configure_parallel(bool enable, size_t sync_quantum)
+{
+  parallel = enable && procs.size() > 1;
+  this->sync_quantum = std::max(sync_quantum, size_t(1));
+
+  for (processor_t *proc : procs)
+    proc->get_mmu()->set_parallel(parallel);
 }
 
 void sim_t::set_procs_debug(bool value)
@@ -216,6 +621,18 @@ bool sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
   return bus.store(addr, len, bytes);
 }
 
+abstract_device_t* sim_t::mmio_device(reg_t addr, reg_t* base, reg_t* size)
+{
+  if (!paddr_ok(addr))
+    return NULL;
+  abstract_device_t* dev = bus.find_device(addr, base, size);
+  // the range is cached, so it must not cover addresses mmio_load refuses
+  reg_t limit = reg_t(1) << MAX_PADDR_BITS;
+  if (dev && *size > limit - *base)
+    *size = limit - *base;
+  return dev;
+}
+
 void sim_t::make_dtb()
 {
   if (!dtb_file.empty()) {
@@ -281,16 +698,17 @@ void sim_t::set_rom()
 
   boot_rom.reset(new rom_device_t(rom));
   bus.add_device(DEFAULT_RSTVEC, boot_rom.get());
+
+  // forget any MMIO device cached from the ROM this replaces
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->get_mmu()->flush_tlb();
+  debug_mmu->flush_tlb();
 }
 
 char* sim_t::addr_to_mem(reg_t addr) {
   if (!paddr_ok(addr))
     return NULL;
-  auto desc = bus.find_device(addr);
-  if (auto mem = dynamic_cast<mem_t*>(desc.second))
-    if (addr - desc.first < mem->size())
-      return mem->contents() + (addr - desc.first);
-  return NULL;
+  return bus.find_mem(addr);
 }
 
 // htif
@@ -299,6 +717,11 @@ void sim_t::reset()
 {
   if (dtb_enabled)
     set_rom();
+
+  if (!restore_path.empty()) {
+    checkpoint_or_die(restore_path, false);
+    restore_path.clear();
+  }
 }
 
 void sim_t::idle()
@@ -306,19 +729,55 @@ void sim_t::idle()
   target.switch_to();
 }
 
+// chunks wholly in memory are copied directly; the rest (MMIO, or
+// straddling regions) go a doubleword at a time through the debug MMU
+char* sim_t::chunk_to_mem(addr_t taddr, size_t len)
+{
+  char* host = addr_to_mem(taddr);
+  if (host && addr_to_mem(taddr + len - 1) == host + len - 1)
+    return host;
+  return NULL;
+}
+
 void sim_t::read_chunk(addr_t taddr, size_t len, void* dst)
 {
-  assert(len == 8);
-  auto data = to_le(debug_mmu->load_uint64(taddr));
-  memcpy(dst, &data, sizeof data);
+  assert(len % 8 == 0);
+  if (char* host = chunk_to_mem(taddr, len)) {
+    memcpy(dst, host, len);
+    return;
+  }
+
+  for (size_t pos = 0; pos < len; pos += 8) {
+    auto data = to_le(debug_mmu->load_uint64(taddr + pos));
+    memcpy((char*)dst + pos, &data, sizeof data);
+  }
 }
 
 void sim_t::write_chunk(addr_t taddr, size_t len, const void* src)
 {
-  assert(len == 8);
-  uint64_t data;
-  memcpy(&data, src, sizeof data);
-  debug_mmu->store_uint64(taddr, from_le(data));
+  assert(len % 8 == 0);
+  if (char* host = chunk_to_mem(taddr, len)) {
+    memcpy(host, src, len);
+    return;
+  }
+
+  for (size_t pos = 0; pos < len; pos += 8) {
+    uint64_t data;
+    memcpy(&data, (const char*)src + pos, sizeof data);
+    debug_mmu->store_uint64(taddr + pos, from_le(data));
+  }
+}
+
+void sim_t::clear_chunk(addr_t taddr, size_t len)
+{
+  assert(len % 8 == 0);
+  if (char* host = chunk_to_mem(taddr, len)) {
+    memset(host, 0, len);
+    return;
+  }
+
+  for (size_t pos = 0; pos < len; pos += 8)
+    debug_mmu->store_uint64(taddr + pos, 0);
 }
 
 void sim_t::proc_reset(unsigned id)
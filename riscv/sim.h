@@ -7,6 +7,7 @@
 #include "devices.h"
 #include "log_file.h"
 #include "processor.h"
+#include "profile.h"
 #include "simif.h"
 
 #include <fesvr/htif.h>
@@ -14,10 +15,16 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <sys/types.h>
 
 class mmu_t;
 class remote_bitbang_t;
+class cache_sim_t;
+class commit_trace_t;
 
 // this class encapsulates the processors and memory in a RISC-V machine.
 class sim_t : public htif_t, public simif_t
@@ -36,15 +43,69 @@ public:
   // run the simulation to completion
   int run();
   void set_debug(bool value);
-  void set_histogram(bool value);
+  void set_jit(bool value);
+  void set_host_fp(bool value);
 
   // Configure logging
   //
   // If enable_log is true, an instruction trace will be generated. If
-  // enable_commitlog is true, so will the commit results (if this
-  // build was configured without support for commit logging, the
-  // function will print an error message and abort).
+  // enable_commitlog is true, so will the commit results.
   void configure_log(bool enable_log, bool enable_commitlog);
+  // write the commit log to path in binary (see commit_trace.h), to which
+  // forked children add their index
+  void set_commit_trace(const std::string& path);
+  // Only log between start and stop (see processor_t::set_log_window), on
+  // every processor. A PC given as a symbol is looked up once the program
+  // is loaded; a marker is passed by the target's mark syscall.
+  void configure_log_window(const log_trigger_t& start, const log_trigger_t& stop);
+
+  // Configure parallel execution
+  //
+  // If enable is true, each processor runs on its own host thread, and
+  // the processors synchronize (and the timer advances) every
+  // sync_quantum instructions.
+  void configure_parallel(bool enable, size_t sync_quantum);
+
+  // Configure checkpointing
+  //
+  // Once every processor has run at least insns instructions, the whole
+  // machine state is written to path and the simulation exits. A restored
+  // run picks up from a checkpoint in place of loading the program image;
+  // it must be given the same configuration and program.
+  void set_checkpoint(uint64_t insns, const char* path);
+  void set_restore(const char* path);
+
+  // Fan out (see htif_t::set_fanout) once every processor has run at least
+  // insns instructions
+  void set_fork_at(uint64_t insns) { fork_insns = insns; }
+
+  // Configure profiling
+  //
+  // Every processor counts the instructions run in each basic block. The
+  // counts of all processors are written together to path (stderr if it is
+  // empty) by write_profile(), and whenever the simulator gets SIGUSR1.
+  // The call graph (see callgraph.h) is written alongside, to its own path,
+  // as folded stacks for flamegraph.pl.
+  void configure_profile(profile_format_t format, const std::string& path);
+  void configure_callgraph(const std::string& path);
+  void write_profile();
+
+  // Configure sampled simulation
+  //
+  // Memory tracers, such as the cache models, only see the accesses of
+  // detailed windows, each of which is preceded by warmup instructions
+  // whose statistics are discarded; the rest of the run is fast-forwarded
+  // with tracing off. Windows are (start, length) pairs counted in
+  // instructions per processor, in increasing order. If period is nonzero,
+  // a further window of the same length starts every period instructions
+  // after the last one. The statistics of caches are printed and cleared at
+  // the end of each window.
+  struct sample_window_t { uint64_t start, length; };
+  void configure_sampling(const std::vector<sample_window_t>& windows,
+                          uint64_t period, uint64_t warmup,
+                          const std::vector<cache_sim_t*>& caches);
+  // report a window cut short by the end of the run
+  void finish_sampling();
 
   void set_procs_debug(bool value);
   void set_remote_bitbang(remote_bitbang_t* remote_bitbang) {
@@ -79,17 +140,77 @@ private:
   static const size_t INTERLEAVE = 5000;
   static const size_t INSNS_PER_RTC_TICK = 100; // 10 MHz clock for 1 BIPS core
   static const size_t CPU_HZ = 1000000000; // 1GHz CPU
+  static const size_t WORKER_SPINS = 1000; // yields before a thread sleeps
   size_t current_step;
   size_t current_proc;
   bool debug;
-  bool histogram_enabled; // provide a histogram of PCs
   bool log;
+  bool log_commits;
+  bool log_windowed;
+  log_trigger_t log_start;
+  log_trigger_t log_stop;
+  void start_log_windows();
+  std::unique_ptr<commit_trace_t> commit_trace;
+  std::string commit_trace_path;
   remote_bitbang_t* remote_bitbang;
 
+  // parallel execution: one host thread per processor, all of which
+  // rendezvous at the end of every sync quantum
+  bool parallel;
+  size_t sync_quantum;
+  size_t rtc_residue;
+  std::vector<std::thread> workers;
+  std::mutex worker_lock;
+  std::condition_variable worker_start;
+  std::condition_variable worker_done;
+  std::atomic<uint64_t> quantum_epoch;
+  std::atomic<size_t> workers_busy;
+  bool workers_exit;
+  void step_parallel(); // run one sync quantum on every processor
+  void worker_main(size_t id);
+  void stop_workers();
+
+  // instructions run by each processor so far, counted in whole
+  // interleave steps or sync quanta
+  uint64_t hart_steps;
+  uint64_t checkpoint_insns;
+  std::string checkpoint_path;
+  std::string restore_path;
+  uint64_t fork_insns;
+
+  // sampled simulation: fast-forward until warmup before the next window,
+  // then warm up, then measure the window itself
+  enum { SAMPLE_OFF, SAMPLE_FAST, SAMPLE_WARM, SAMPLE_DETAIL } sample_phase;
+  std::vector<sample_window_t> sample_windows;
+  size_t sample_index;
+  uint64_t sample_period;
+  uint64_t sample_warmup;
+  uint64_t sample_next; // instruction count of the next phase change
+  uint64_t sample_begin;
+  std::vector<cache_sim_t*> sample_caches;
+  void sample_step();
+  void set_tracing(bool enabled);
+  void print_sample(const char* what);
+
+  bool profile_enabled;
+  profile_format_t profile_format;
+  std::string profile_path;
+  std::string callgraph_path;
+  std::map<reg_t, std::string> symbols; // of all payloads, by address
+  std::map<std::string, reg_t> symbol_addrs; // by name, including aliases
+  std::string program_path; // the main program, named in pprof output
+
+  void prepare_to_fork();
+  void after_fork(size_t child);
+  void mark(uint64_t value);
+  void checkpoint(checkpoint_t& c);
+  void checkpoint_or_die(const std::string& path, bool saving);
+
   // memory-mapped I/O routines
   char* addr_to_mem(reg_t addr);
   bool mmio_load(reg_t addr, size_t len, uint8_t* bytes);
   bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes);
+  abstract_device_t* mmio_device(reg_t addr, reg_t* base, reg_t* size);
   void make_dtb();
   void set_rom();
 
@@ -132,8 +253,12 @@ private:
   void idle();
   void read_chunk(addr_t taddr, size_t len, void* dst);
   void write_chunk(addr_t taddr, size_t len, const void* src);
+  void clear_chunk(addr_t taddr, size_t len);
+  char* chunk_to_mem(addr_t taddr, size_t len);
+  std::map<std::string, uint64_t> load_payload(const std::string& payload, reg_t* entry);
+  bool is_address_preloaded(addr_t taddr, size_t len) { return !restore_path.empty(); }
   size_t chunk_align() { return 8; }
-  size_t chunk_max_size() { return 8; }
+  size_t chunk_max_size() { return 1 << 20; }
 
 public:
   // Initialize this after procs, because in debug_module_t::reset() we
@@ -5,6 +5,8 @@
 
 #include "decode.h"
 
+class abstract_device_t;
+
 // this is the interface to the simulator used by the processors and memory
 class simif_t
 {
@@ -14,6 +16,9 @@ public:
   // used for MMIO addresses
   virtual bool mmio_load(reg_t addr, size_t len, uint8_t* bytes) = 0;
   virtual bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes) = 0;
+  // the MMIO device decoding addr and the range it covers, so that later
+  // accesses in that range can go to it directly; NULL if unsupported
+  virtual abstract_device_t* mmio_device(reg_t addr, reg_t* base, reg_t* size) { return NULL; }
   // Callback for processors to let the simulation know they were reset.
   virtual void proc_reset(unsigned id) = 0;
 };
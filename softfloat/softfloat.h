@@ -50,8 +50,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdint.h>
 #include "softfloat_types.h"
 
+/* Harts may run on separate host threads, so each needs its own flags. */
 #ifndef THREAD_LOCAL
-#define THREAD_LOCAL
+#define THREAD_LOCAL __thread
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,253 @@
+// See LICENSE for license details.
+
+// This little program measures the speed of the instruction-execution
+// fast path. It runs a few hand-assembled RV64 kernels on a single
+// processor attached to a flat memory, and reports millions of simulated
+// instructions per host second for each. With --check, it instead runs
+// each kernel with and without the JIT and compares the two machines.
+
+#include "processor.h"
+#include "mmu.h"
+#include "simif.h"
+#include <fesvr/option_parser.h>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+static const reg_t MEM_BASE = 0x80000000;
+static const reg_t MEM_SIZE = 1 << 20;
+static const reg_t DATA_OFFSET = MEM_SIZE / 2;
+
+class bench_sim_t : public simif_t
+{
+public:
+  bench_sim_t() : mem(MEM_SIZE) {}
+
+  char* addr_to_mem(reg_t addr)
+  {
+    if (addr >= MEM_BASE && addr - MEM_BASE < mem.size())
+      return &mem[addr - MEM_BASE];
+    return NULL;
+  }
+  bool mmio_load(reg_t addr, size_t len, uint8_t* bytes) { return false; }
+  bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes) { return false; }
+  void proc_reset(unsigned id) {}
+
+  void load(const std::vector<uint32_t>& code)
+  {
+    memset(&mem[0], 0, mem.size());
+    memcpy(&mem[0], &code[0], code.size() * sizeof(uint32_t));
+  }
+
+  const std::vector<char>& memory() const { return mem; }
+
+private:
+  std::vector<char> mem;
+};
+
+// instruction encoders
+enum { zero = 0, ra = 1, t0 = 5, t1 = 6, t2 = 7, a0 = 10, a1 = 11,
+       t3 = 28, t4 = 29, t5 = 30, t6 = 31 };
+
+static uint32_t r_type(int funct7, int rs2, int rs1, int funct3, int rd, int opcode)
+{
+  return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t i_type(int imm, int rs1, int funct3, int rd, int opcode)
+{
+  return (imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t s_type(int imm, int rs2, int rs1, int funct3, int opcode)
+{
+  return ((imm >> 5) & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+         (imm & 0x1f) << 7 | opcode;
+}
+
+static uint32_t b_type(int imm, int rs2, int rs1, int funct3, int opcode)
+{
+  return ((imm >> 12) & 1) << 31 | ((imm >> 5) & 0x3f) << 25 | rs2 << 20 |
+         rs1 << 15 | funct3 << 12 | ((imm >> 1) & 0xf) << 8 |
+         ((imm >> 11) & 1) << 7 | opcode;
+}
+
+static uint32_t j_type(int imm, int rd, int opcode)
+{
+  return ((imm >> 20) & 1) << 31 | ((imm >> 1) & 0x3ff) << 21 |
+         ((imm >> 11) & 1) << 20 | ((imm >> 12) & 0xff) << 12 | rd << 7 | opcode;
+}
+
+static uint32_t add(int rd, int rs1, int rs2) { return r_type(0, rs2, rs1, 0, rd, 0x33); }
+static uint32_t sub(int rd, int rs1, int rs2) { return r_type(0x20, rs2, rs1, 0, rd, 0x33); }
+static uint32_t xor_(int rd, int rs1, int rs2) { return r_type(0, rs2, rs1, 4, rd, 0x33); }
+static uint32_t or_(int rd, int rs1, int rs2) { return r_type(0, rs2, rs1, 6, rd, 0x33); }
+static uint32_t and_(int rd, int rs1, int rs2) { return r_type(0, rs2, rs1, 7, rd, 0x33); }
+static uint32_t addi(int rd, int rs1, int imm) { return i_type(imm, rs1, 0, rd, 0x13); }
+static uint32_t andi(int rd, int rs1, int imm) { return i_type(imm, rs1, 7, rd, 0x13); }
+static uint32_t slli(int rd, int rs1, int sh) { return i_type(sh, rs1, 1, rd, 0x13); }
+static uint32_t auipc(int rd, int imm) { return (imm & 0xfffff) << 12 | rd << 7 | 0x17; }
+static uint32_t ld(int rd, int rs1, int imm) { return i_type(imm, rs1, 3, rd, 0x03); }
+static uint32_t lw(int rd, int rs1, int imm) { return i_type(imm, rs1, 2, rd, 0x03); }
+static uint32_t sd(int rs2, int rs1, int imm) { return s_type(imm, rs2, rs1, 3, 0x23); }
+static uint32_t sw(int rs2, int rs1, int imm) { return s_type(imm, rs2, rs1, 2, 0x23); }
+static uint32_t beq(int rs1, int rs2, int imm) { return b_type(imm, rs2, rs1, 0, 0x63); }
+static uint32_t jal(int rd, int imm) { return j_type(imm, rd, 0x6f); }
+static uint32_t jalr(int rd, int rs1, int imm) { return i_type(imm, rs1, 0, rd, 0x67); }
+
+struct kernel_t {
+  const char* name;
+  std::vector<uint32_t> code;
+};
+
+// each kernel is an infinite loop, so it can run for any number of steps
+static std::vector<kernel_t> make_kernels()
+{
+  std::vector<kernel_t> kernels;
+
+  kernels.push_back({"alu", {
+    addi(t1, zero, 1000),
+    addi(t0, t0, 1),        // loop:
+    xor_(t2, t0, t1),
+    add(t3, t3, t2),
+    slli(t4, t3, 3),
+    sub(t5, t4, t0),
+    and_(t6, t5, t2),
+    or_(a1, a1, t6),
+    jal(zero, -28),         // j loop
+  }});
+
+  kernels.push_back({"memory", {
+    auipc(a0, DATA_OFFSET >> 12),
+    ld(t0, a0, 0),          // loop:
+    addi(t0, t0, 1),
+    sd(t0, a0, 0),
+    ld(t1, a0, 8),
+    add(t1, t1, t0),
+    sd(t1, a0, 8),
+    lw(t2, a0, 16),
+    sw(t1, a0, 16),
+    jal(zero, -32),         // j loop
+  }});
+
+  kernels.push_back({"branch", {
+    addi(t0, t0, 1),        // loop:
+    andi(t1, t0, 1),
+    beq(t1, zero, 8),       // beqz t1, skip
+    addi(t2, t2, 1),
+    jal(ra, 12),            // skip: call func
+    jal(zero, -20),         // j loop
+    0,
+    addi(t3, t3, 1),        // func:
+    jalr(zero, ra, 0),      // ret
+  }});
+
+  // stores to the page holding the loop, so decoded code keeps being dropped
+  kernels.push_back({"mixed", {
+    auipc(a0, 0),
+    addi(a0, a0, 1024),     // data after the code, on the same page
+    ld(t0, a0, 0),          // loop:
+    addi(t0, t0, 1),
+    sd(t0, a0, 0),
+    add(t1, t1, t0),
+    jal(zero, -16),         // j loop
+  }});
+
+  return kernels;
+}
+
+// Run a kernel on two machines, one with the JIT, and compare their PCs
+// and registers after every chunk of steps and their memory at the end.
+static bool check_kernel(const kernel_t& kernel, const char* isa, size_t insns,
+                         size_t chunk)
+{
+  bench_sim_t sim[2];
+  std::unique_ptr<processor_t> p[2];
+  for (int i = 0; i < 2; i++) {
+    sim[i].load(kernel.code);
+    p[i].reset(new processor_t(isa, DEFAULT_PRIV, DEFAULT_VARCH, &sim[i], 0,
+                               false, stderr));
+    p[i]->get_state()->pc = MEM_BASE;
+    p[i]->get_mmu()->set_jit(i == 1);
+  }
+
+  for (size_t n = 0; n < insns; n += chunk) {
+    for (int i = 0; i < 2; i++)
+      p[i]->step(std::min(chunk, insns - n));
+
+    const state_t* s[2] = {p[0]->get_state(), p[1]->get_state()};
+    if (s[0]->pc != s[1]->pc || s[0]->minstret != s[1]->minstret) {
+      printf("%-8s pc 0x%" PRIx64 " after %" PRIu64 " insns without the JIT, "
+             "0x%" PRIx64 " after %" PRIu64 " with it\n", kernel.name,
+             s[0]->pc, s[0]->minstret, s[1]->pc, s[1]->minstret);
+      return false;
+    }
+    for (int r = 1; r < NXPR; r++) {
+      if (s[0]->XPR[r] != s[1]->XPR[r]) {
+        printf("%-8s x%d is 0x%" PRIx64 " without the JIT, 0x%" PRIx64
+               " with it, at pc 0x%" PRIx64 "\n", kernel.name, r,
+               s[0]->XPR[r], s[1]->XPR[r], s[0]->pc);
+        return false;
+      }
+    }
+  }
+
+  const std::vector<char>& m0 = sim[0].memory();
+  const std::vector<char>& m1 = sim[1].memory();
+  for (size_t i = 0; i < m0.size(); i++) {
+    if (m0[i] != m1[i]) {
+      printf("%-8s memory at 0x%" PRIx64 " differs\n", kernel.name, MEM_BASE + i);
+      return false;
+    }
+  }
+
+  printf("%-8s %12" PRIu64 " insns match\n", kernel.name, p[0]->get_state()->minstret);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  size_t insns = 200000000;
+  const char* isa = "RV64IMAFDC";
+  bool jit = false;
+  bool check = false;
+
+  option_parser_t parser;
+  parser.option('n', 0, 1, [&](const char* s){insns = strtoull(s, 0, 0);});
+  parser.option(0, "isa", 1, [&](const char* s){isa = s;});
+  parser.option(0, "jit", 0, [&](const char* s){jit = true;});
+  parser.option(0, "check", 0, [&](const char* s){check = true;});
+  parser.parse(argv);
+
+  bench_sim_t sim;
+  const size_t chunk = 5000;
+
+  if (check) {
+    int failed = 0;
+    for (auto& kernel : make_kernels())
+      failed += !check_kernel(kernel, isa, insns, chunk);
+    return failed != 0;
+  }
+
+  for (auto& kernel : make_kernels()) {
+    sim.load(kernel.code);
+    processor_t p(isa, DEFAULT_PRIV, DEFAULT_VARCH, &sim, 0, false, stderr);
+    p.get_state()->pc = MEM_BASE;
+    p.get_mmu()->set_jit(jit);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < insns; i += chunk)
+      p.step(std::min(chunk, insns - i));
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    reg_t retired = p.get_state()->minstret;
+    printf("%-8s %12" PRIu64 " insns %8.3f s %9.2f MIPS\n", kernel.name,
+           retired, elapsed.count(), retired / elapsed.count() / 1e6);
+  }
+
+  return 0;
+}
@@ -0,0 +1,425 @@
+// See LICENSE for license details.
+
+// This little program checks the host-FPU arithmetic of --host-fp (see
+// host_fp.h) against softfloat, and measures both. It runs the scalar
+// operations over random and edge-case operands in every rounding mode,
+// and each vector instruction with and without host FP on a pair of
+// processors attached to a flat memory, comparing results and fflags bit
+// for bit. Then it reports operations (or elements) per host second.
+
+#include "processor.h"
+#include "mmu.h"
+#include "simif.h"
+#include "host_fp.h"
+#include <fesvr/option_parser.h>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static const reg_t MEM_BASE = 0x80000000;
+static const reg_t MEM_SIZE = 1 << 16;
+static const char* const VARCH = "vlen:1024,elen:64,slen:1024";
+
+class fp_sim_t : public simif_t
+{
+public:
+  fp_sim_t() : mem(MEM_SIZE) {}
+
+  char* addr_to_mem(reg_t addr)
+  {
+    if (addr >= MEM_BASE && addr - MEM_BASE < mem.size())
+      return &mem[addr - MEM_BASE];
+    return NULL;
+  }
+  bool mmio_load(reg_t addr, size_t len, uint8_t* bytes) { return false; }
+  bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes) { return false; }
+  void proc_reset(unsigned id) {}
+
+  void load(const std::vector<uint32_t>& code)
+  {
+    memset(&mem[0], 0, mem.size());
+    memcpy(&mem[0], &code[0], code.size() * sizeof(uint32_t));
+  }
+
+private:
+  std::vector<char> mem;
+};
+
+// Operands of 32 or 64 bits: with probability special, an edge case (NaNs,
+// infinities, zeros, subnormals, extreme exponents, small integers, which
+// often give exact results, or any bits at all), and otherwise a normal
+// number between 2^-8 and 2^8.
+class operand_gen_t
+{
+public:
+  operand_gen_t(uint64_t seed) : rng(seed) {}
+
+  uint64_t bits(int n) { return n ? rng() >> (64 - n) : 0; }
+  double uniform() { return std::uniform_real_distribution<double>(0, 1)(rng); }
+
+  uint64_t operator()(int width, double special)
+  {
+    const int man = width == 32 ? 23 : 52;
+    const uint64_t emax = width == 32 ? 0xff : 0x7ff;
+    const uint64_t bias = emax >> 1;
+    const uint64_t quiet = uint64_t(1) << (man - 1);
+    uint64_t sign = bits(1) << (width - 1);
+    uint64_t frac = bits(man);
+
+    if (uniform() >= special)
+      return sign | (bias - 8 + bits(4)) << man | frac;
+
+    switch (rng() % 12) {
+      case 0: return sign;                                      // zero
+      case 1: return sign | emax << man;                        // infinity
+      case 2: return sign | emax << man | quiet | frac;         // quiet NaN
+      case 3: return sign | emax << man | (frac & (quiet - 1)) | 1; // signaling
+      case 4: return sign | frac;                               // subnormal
+      case 5: return sign | 1;                                  // least subnormal
+      case 6: return sign | uint64_t(1) << man;                 // least normal
+      case 7: return sign | ((emax << man) - 1);                // greatest normal
+      case 8: return sign | (emax - 1 - bits(4)) << man | frac; // near overflow
+      case 9: return sign | (bias / 2 + 16 - bits(5)) << man | frac; // products
+                                                                // near underflow
+      case 10: return small_integer(width, bits(8));
+      default: return bits(width);
+    }
+  }
+
+private:
+  std::mt19937_64 rng;
+
+  static uint64_t small_integer(int width, int n)
+  {
+    if (width == 32) {
+      float x = n;
+      uint32_t u;
+      memcpy(&u, &x, sizeof(u));
+      return u;
+    }
+    double x = n;
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+  }
+};
+
+static const double densities[] = {0, 0.001, 0.05, 1};
+static const int NDENSITIES = sizeof(densities) / sizeof(densities[0]);
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+static volatile uint64_t sink;
+
+// scalar operations
+
+template<class T>
+struct scalar_op_t {
+  const char* name;
+  T (*soft)(T, T);
+  T (*host)(T, T);
+};
+
+static const scalar_op_t<float32_t> f32_ops[] = {
+  {"fadd.s", f32_add, host_f32_add},
+  {"fsub.s", f32_sub, host_f32_sub},
+  {"fmul.s", f32_mul, host_f32_mul},
+  {"fdiv.s", f32_div, host_f32_div},
+};
+
+static const scalar_op_t<float64_t> f64_ops[] = {
+  {"fadd.d", f64_add, host_f64_add},
+  {"fsub.d", f64_sub, host_f64_sub},
+  {"fmul.d", f64_mul, host_f64_mul},
+  {"fdiv.d", f64_div, host_f64_div},
+};
+
+// compare n operand pairs of each density in each rounding mode, printing
+// the first few mismatches; returns the number of them
+template<class T>
+static size_t check_scalar(const scalar_op_t<T>& op, operand_gen_t& gen, size_t n)
+{
+  const int width = sizeof(T) * 8;
+  size_t bad = 0;
+
+  for (int rm = softfloat_round_near_even; rm <= softfloat_round_near_maxMag; rm++) {
+    for (size_t i = 0; i < n * NDENSITIES; i++) {
+      double special = densities[i % NDENSITIES];
+      T a, b;
+      a.v = gen(width, special);
+      b.v = gen(width, special);
+
+      softfloat_roundingMode = rm;
+      softfloat_exceptionFlags = 0;
+      T want = op.soft(a, b);
+      uint_fast8_t want_flags = softfloat_exceptionFlags;
+      softfloat_exceptionFlags = 0;
+      T got = op.host(a, b);
+      uint_fast8_t got_flags = softfloat_exceptionFlags;
+
+      if (got.v != want.v || got_flags != want_flags) {
+        if (bad++ < 10)
+          printf("%s rm=%d %0*" PRIx64 ", %0*" PRIx64 ": got %0*" PRIx64
+                 " flags %02x, want %0*" PRIx64 " flags %02x\n", op.name, rm,
+                 width / 4, uint64_t(a.v), width / 4, uint64_t(b.v),
+                 width / 4, uint64_t(got.v), got_flags,
+                 width / 4, uint64_t(want.v), want_flags);
+      }
+    }
+  }
+
+  softfloat_exceptionFlags = 0;
+  return bad;
+}
+
+// operations per second of fn over a and b, in round to nearest-even
+template<class T>
+static double scalar_rate(T (*fn)(T, T), const std::vector<T>& a,
+                          const std::vector<T>& b, size_t reps)
+{
+  softfloat_roundingMode = softfloat_round_near_even;
+  uint64_t x = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < reps; r++)
+    for (size_t i = 0; i < a.size(); i++)
+      x ^= fn(a[i], b[i]).v;
+  double elapsed = seconds_since(start);
+  sink = x;
+  softfloat_exceptionFlags = 0;
+  return reps * a.size() / elapsed;
+}
+
+template<class T>
+static void bench_scalar(const scalar_op_t<T>& op, operand_gen_t& gen, size_t reps)
+{
+  const size_t n = 4096;
+  std::vector<T> a(n), b(n);
+  for (size_t i = 0; i < n; i++) {
+    a[i].v = gen(sizeof(T) * 8, 0);
+    b[i].v = gen(sizeof(T) * 8, 0);
+  }
+
+  double soft = scalar_rate(op.soft, a, b, reps);
+  double host = scalar_rate(op.host, a, b, reps);
+  printf("%-11s soft %9.2f Mops/s  host %9.2f Mops/s  %5.2fx\n",
+         op.name, soft / 1e6, host / 1e6, host / soft);
+}
+
+// vector instructions, each run as vd = op(v16, v24 or f10) in slots of
+// memory that set vtype from a0 and then loop over the instruction
+
+enum { zero = 0, t0 = 5, a0 = 10, f10 = 10 };
+
+static uint32_t j_type(int imm, int rd, int opcode)
+{
+  return ((imm >> 20) & 1) << 31 | ((imm >> 1) & 0x3ff) << 21 |
+         ((imm >> 11) & 1) << 20 | ((imm >> 12) & 0xff) << 12 | rd << 7 | opcode;
+}
+
+struct vector_op_t {
+  const char* name;
+  uint32_t match;
+  bool vf;
+};
+
+static const vector_op_t vector_ops[] = {
+  {"vfadd.vv", MATCH_VFADD_VV, false},
+  {"vfadd.vf", MATCH_VFADD_VF, true},
+  {"vfsub.vv", MATCH_VFSUB_VV, false},
+  {"vfsub.vf", MATCH_VFSUB_VF, true},
+  {"vfrsub.vf", MATCH_VFRSUB_VF, true},
+  {"vfmul.vv", MATCH_VFMUL_VV, false},
+  {"vfmul.vf", MATCH_VFMUL_VF, true},
+  {"vfdiv.vv", MATCH_VFDIV_VV, false},
+  {"vfdiv.vf", MATCH_VFDIV_VF, true},
+  {"vfrdiv.vf", MATCH_VFRDIV_VF, true},
+};
+static const int NVECTOR_OPS = sizeof(vector_ops) / sizeof(vector_ops[0]);
+
+static const int sews[] = {32, 64};
+static const int NSEWS = 2;
+
+// unmasked into v8, masked, and in place over each source
+static const int NVARIANTS = 4;
+
+static reg_t slot(int op, int sew, int variant)
+{
+  return MEM_BASE + 16 * ((op * NSEWS + sew) * NVARIANTS + variant);
+}
+
+static std::vector<uint32_t> make_vector_code()
+{
+  std::vector<uint32_t> code;
+  for (int op = 0; op < NVECTOR_OPS; op++) {
+    for (int sew = 0; sew < NSEWS; sew++) {
+      for (int variant = 0; variant < NVARIANTS; variant++) {
+        reg_t vtype = (sews[sew] == 32 ? 2 : 3) << 2 | 3; // LMUL 8
+        uint32_t vd = variant == 2 ? 16 : variant == 3 ? 24 : 8;
+        uint32_t vm = variant != 1;
+        uint32_t rs1 = vector_ops[op].vf ? f10 : 24;
+        code.push_back(MATCH_VSETVLI | vtype << 20 | a0 << 15 | t0 << 7);
+        code.push_back(vector_ops[op].match | vm << 25 | 16 << 20 | rs1 << 15 | vd << 7);
+        code.push_back(j_type(-4, zero, 0x6f)); // j .-4
+        code.push_back(0);
+      }
+    }
+  }
+  return code;
+}
+
+static void set_vector_state(processor_t& p, const std::vector<char>& regs,
+                             uint64_t f, reg_t avl, uint32_t frm, reg_t pc)
+{
+  memcpy(p.VU.reg_file, &regs[0], regs.size());
+  freg_t fr;
+  fr.v[0] = f;
+  fr.v[1] = -1;
+  p.get_state()->FPR.write(f10, fr);
+  p.get_state()->XPR.write(a0, avl);
+  p.get_state()->fflags = 0;
+  p.get_state()->frm = frm;
+  p.get_state()->pc = pc;
+}
+
+static void enable_fp_and_vector(processor_t& p)
+{
+  p.set_csr(CSR_MSTATUS, MSTATUS_FS | MSTATUS_VS);
+}
+
+static size_t check_vector(processor_t& soft, processor_t& host, int op,
+                           operand_gen_t& gen, size_t n)
+{
+  const size_t bytes = NVPR * soft.VU.vlenb;
+  std::vector<char> regs(bytes);
+  size_t bad = 0;
+
+  for (int sew = 0; sew < NSEWS; sew++) {
+    const int width = sews[sew];
+    const reg_t vlmax = 8 * soft.VU.vlenb / (width / 8);
+    for (int variant = 0; variant < NVARIANTS; variant++) {
+      for (size_t t = 0; t < n * NDENSITIES; t++) {
+        double special = densities[t % NDENSITIES];
+        for (size_t i = 0; i < bytes; i += width / 8) {
+          uint64_t x = gen(width, special);
+          memcpy(&regs[i], &x, width / 8);
+        }
+        for (size_t i = 0; i < soft.VU.vlenb; i++)
+          regs[i] = gen.bits(8); // the mask
+        uint64_t f = gen(width, special);
+        if (width == 32 && gen.uniform() < 0.95)
+          f |= uint64_t(-1) << 32; // NaN-boxed, usually
+        reg_t avl = t % 3 ? gen.bits(16) % (vlmax + 1) : vlmax;
+        uint32_t frm = t % 2 ? softfloat_round_near_even : gen.bits(8) % 5;
+        reg_t vstart = t % 5 ? 0 : gen.bits(16) % (avl + 1);
+
+        for (processor_t* p : {&soft, &host}) {
+          set_vector_state(*p, regs, f, avl, frm, slot(op, sew, variant));
+          p->step(1);
+          p->VU.vstart = vstart;
+          p->step(1);
+        }
+
+        if (memcmp(soft.VU.reg_file, host.VU.reg_file, bytes) != 0 ||
+            soft.get_state()->fflags != host.get_state()->fflags ||
+            soft.get_state()->pc != host.get_state()->pc) {
+          if (bad++ < 10)
+            printf("%s e%d variant %d avl %" PRIu64 " vstart %" PRIu64
+                   " frm %u: results differ (fflags %02x, want %02x)\n",
+                   vector_ops[op].name, width, variant, avl, vstart, frm,
+                   host.get_state()->fflags, soft.get_state()->fflags);
+        }
+      }
+    }
+  }
+  return bad;
+}
+
+// elements per second of op over whole register groups of normal numbers
+static double vector_rate(processor_t& p, int op, int sew, operand_gen_t& gen,
+                          size_t reps)
+{
+  const int width = sews[sew];
+  const size_t bytes = NVPR * p.VU.vlenb;
+  std::vector<char> regs(bytes);
+  for (size_t i = 0; i < bytes; i += width / 8) {
+    uint64_t x = gen(width, 0);
+    memcpy(&regs[i], &x, width / 8);
+  }
+  uint64_t f = gen(width, 0) | (width == 32 ? uint64_t(-1) << 32 : 0);
+  const reg_t vlmax = 8 * p.VU.vlenb / (width / 8);
+
+  set_vector_state(p, regs, f, vlmax, softfloat_round_near_even, slot(op, sew, 0));
+  p.step(1);
+  auto start = std::chrono::steady_clock::now();
+  p.step(2 * reps); // the instruction and the jump back to it
+  double elapsed = seconds_since(start);
+  return reps * vlmax / elapsed;
+}
+
+int main(int argc, char** argv)
+{
+  size_t n = 20000;
+  size_t vector_n = 100;
+  size_t reps = 2000;
+  uint64_t seed = 1;
+  bool bench = true;
+
+  option_parser_t parser;
+  parser.option('n', 0, 1, [&](const char* s){n = strtoull(s, 0, 0);});
+  parser.option(0, "vector-n", 1, [&](const char* s){vector_n = strtoull(s, 0, 0);});
+  parser.option(0, "reps", 1, [&](const char* s){reps = strtoull(s, 0, 0);});
+  parser.option(0, "seed", 1, [&](const char* s){seed = strtoull(s, 0, 0);});
+  parser.option(0, "no-bench", 0, [&](const char* s){bench = false;});
+  parser.parse(argv);
+
+#ifndef HOST_FP_SUPPORTED
+  printf("host FP isn't supported in this build; it is softfloat\n");
+#endif
+
+  operand_gen_t gen(seed);
+  size_t bad = 0;
+
+  for (auto& op : f32_ops)
+    bad += check_scalar(op, gen, n);
+  for (auto& op : f64_ops)
+    bad += check_scalar(op, gen, n);
+
+  fp_sim_t sim;
+  sim.load(make_vector_code());
+  processor_t soft("RV64IMAFDCV", DEFAULT_PRIV, VARCH, &sim, 0, false, stderr);
+  processor_t host("RV64IMAFDCV", DEFAULT_PRIV, VARCH, &sim, 1, false, stderr);
+  host.set_host_fp(true);
+  enable_fp_and_vector(soft);
+  enable_fp_and_vector(host);
+
+  for (int op = 0; op < NVECTOR_OPS; op++)
+    bad += check_vector(soft, host, op, gen, vector_n);
+
+  printf("%zu mismatches\n", bad);
+
+  if (bench) {
+    for (auto& op : f32_ops)
+      bench_scalar(op, gen, reps);
+    for (auto& op : f64_ops)
+      bench_scalar(op, gen, reps);
+
+    for (int op = 0; op < NVECTOR_OPS; op++) {
+      for (int sew = 0; sew < NSEWS; sew++) {
+        double s = vector_rate(soft, op, sew, gen, reps * 10);
+        double h = vector_rate(host, op, sew, gen, reps * 10);
+        printf("%-9s e%d soft %9.2f Melem/s host %9.2f Melem/s %5.2fx\n",
+               vector_ops[op].name, sews[sew], s / 1e6, h / 1e6, h / s);
+      }
+    }
+  }
+
+  return bad != 0;
+}
@@ -3,7 +3,8 @@
 // This little program finds occurrences of strings like
 //   core   0: 0x000000008000c36c (0xfe843783) ld      a5, -24(s0)
 // in its inputs, then output the RISC-V instruction with the disassembly
-// enclosed hexadecimal number.
+// enclosed hexadecimal number. With --trace, it instead prints a binary
+// commit trace (see riscv/commit_trace.h) as the text commit log.
 
 #include <iostream>
 #include <string>
@@ -13,6 +14,7 @@
 
 #include "disasm.h"
 #include "extension.h"
+#include "commit_trace.h"
 
 using namespace std;
 
@@ -25,8 +27,25 @@ int main(int argc, char** argv)
   option_parser_t parser;
   parser.option(0, "extension", 1, [&](const char* s){extension = find_extension(s);});
   parser.option(0, "isa", 1, [&](const char* s){isa = s;});
+  const char* trace = NULL;
+  parser.option(0, "trace", 1, [&](const char* s){trace = s;});
   parser.parse(argv);
 
+  if (trace) {
+    FILE* in = fopen(trace, "rb");
+    if (!in) {
+      fprintf(stderr, "couldn't open %s\n", trace);
+      return 1;
+    }
+    bool ok = commit_trace_t::decode(in, stdout);
+    fclose(in);
+    if (!ok) {
+      fprintf(stderr, "%s: not a valid commit trace\n", trace);
+      return 1;
+    }
+    return 0;
+  }
+
   processor_t p(isa, DEFAULT_PRIV, DEFAULT_VARCH, 0, 0, false, nullptr);
   if (extension) {
     p.register_extension(extension());
@@ -9,10 +9,18 @@
 #include <fesvr/option_parser.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <functional>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <memory>
 #include <fstream>
+#include <sstream>
 #include "../VERSION"
 
 static void help(int exit_code = 1)
@@ -21,12 +29,54 @@ static void help(int exit_code = 1)
   fprintf(stderr, "usage: spike [host options] <target program> [target options]\n");
   fprintf(stderr, "Host Options:\n");
   fprintf(stderr, "  -p<n>                 Simulate <n> processors [default 1]\n");
+  fprintf(stderr, "  --parallel            Run each processor on its own host thread\n");
+  fprintf(stderr, "  --sync-quantum=<n>    Synchronize parallel processors every <n>\n");
+  fprintf(stderr, "                          instructions [default 5000]\n");
+  fprintf(stderr, "  --jit                 Translate hot integer code to host code\n");
+  fprintf(stderr, "  --host-fp             Do F/D/V arithmetic on the host FPU where it gives\n");
+  fprintf(stderr, "                          the same results\n");
   fprintf(stderr, "  -m<n>                 Provide <n> MiB of target memory [default 2048]\n");
   fprintf(stderr, "  -m<a:m,b:n,...>       Provide memory regions of size m and n bytes\n");
   fprintf(stderr, "                          at base addresses a and b (with 4 KiB alignment)\n");
+  fprintf(stderr, "  --mem-file=<path>     Back target memory with a shared mapping of <path>,\n");
+  fprintf(stderr, "                          which supplies its initial contents\n");
+  fprintf(stderr, "  --hugepages           Back target memory with huge pages where possible\n");
+  fprintf(stderr, "  --checkpoint=<n>:<file>\n");
+  fprintf(stderr, "                        Save the machine state to <file> and exit once\n");
+  fprintf(stderr, "                          each processor has run <n> instructions; the\n");
+  fprintf(stderr, "                          state of --device plugins isn't saved\n");
+  fprintf(stderr, "  --restore=<file>      Resume from a checkpoint of the same program\n");
+  fprintf(stderr, "  --fork-args=<file>    At a fork point, split into one child process per\n");
+  fprintf(stderr, "                          line of <file>, which gives its target arguments\n");
+  fprintf(stderr, "  --fork-at=<n>         Fork once each processor has run <n> instructions\n");
+  fprintf(stderr, "                          [default: when the target requests it]\n");
+  fprintf(stderr, "  --fork-jobs=<n>       Run at most <n> forked children at once\n");
+  fprintf(stderr, "                          [default: number of host CPUs]\n");
   fprintf(stderr, "  -d                    Interactive debug mode\n");
-  fprintf(stderr, "  -g                    Track histogram of PCs\n");
+  fprintf(stderr, "  -g                    Print a histogram of basic blocks at exit\n");
+  fprintf(stderr, "  --profile=<format>:<file>\n");
+  fprintf(stderr, "                        Count instructions by basic block and write them\n");
+  fprintf(stderr, "                          to <file> at exit or on SIGUSR1, as one of\n");
+  fprintf(stderr, "                          histogram, csv, collapsed or pprof; forked\n");
+  fprintf(stderr, "                          child <i> writes <file>.<i>\n");
+  fprintf(stderr, "  --callgraph=<file>    Track call stacks and write instruction counts by\n");
+  fprintf(stderr, "                          stack to <file> as folded stacks, at exit or on\n");
+  fprintf(stderr, "                          SIGUSR1; forked child <i> writes <file>.<i>\n");
+  fprintf(stderr, "  --bbv=<n>:<file>      Write SimPoint basic-block vectors for every <n>\n");
+  fprintf(stderr, "                          instructions to <file> (<file>.<i> for hart i\n");
+  fprintf(stderr, "                          if there are several); forked child <j> writes\n");
+  fprintf(stderr, "                          later intervals to <file>.<j>\n");
   fprintf(stderr, "  -l                    Generate a log of execution\n");
+  fprintf(stderr, "  --log-commits         Generate a log of commits info\n");
+  fprintf(stderr, "  --commit-trace=<file> Log commits to <file> in binary; spike-log-parser\n");
+  fprintf(stderr, "                          --trace=<file> prints them as text\n");
+  fprintf(stderr, "  --log-start=<cond>    Only log (-l, --log-commits) once <cond> is met:\n");
+  fprintf(stderr, "                          pc=<address|symbol>, insn=<minstret>,\n");
+  fprintf(stderr, "                          csr=<name|number> (when a CSR instruction writes\n");
+  fprintf(stderr, "                          it) or marker=<n> (passed by the target's\n");
+  fprintf(stderr, "                          syscall 2013)\n");
+  fprintf(stderr, "  --log-stop=<cond>     Stop logging when <cond> is met, until the start\n");
+  fprintf(stderr, "                          condition is met again\n");
   fprintf(stderr, "  -h, --help            Print this help message\n");
   fprintf(stderr, "  -H                    Start halted, allowing a debugger to connect\n");
   fprintf(stderr, "  --isa=<name>          RISC-V ISA string [default %s]\n", DEFAULT_ISA);
@@ -37,6 +87,8 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --ic=<S>:<W>:<B>      Instantiate a cache model with S sets,\n");
   fprintf(stderr, "  --dc=<S>:<W>:<B>        W ways, and B-byte blocks (with S and\n");
   fprintf(stderr, "  --l2=<S>:<W>:<B>        B both powers of 2).\n");
+  fprintf(stderr, "  --tlb=<S>:<W>         Use an S-set, W-way second-level TLB per hart and\n");
+  fprintf(stderr, "                          report its statistics [default 256:4; 0:0 disables]\n");
   fprintf(stderr, "  --device=<P,B,A>      Attach MMIO plugin device from an --extlib library\n");
   fprintf(stderr, "                          P -- Name of the MMIO plugin\n");
   fprintf(stderr, "                          B -- Base memory address of the device\n");
@@ -44,6 +96,12 @@ static void help(int exit_code = 1)
   fprintf(stderr, "                          This flag can be used multiple times.\n");
   fprintf(stderr, "                          The extlib flag for the library must come first.\n");
   fprintf(stderr, "  --log-cache-miss      Generate a log of cache miss\n");
+  fprintf(stderr, "  --sample=<P>:<L>      Only model caches for the last L instructions of\n");
+  fprintf(stderr, "                          every P, printing statistics for each window\n");
+  fprintf(stderr, "  --simpoints=<file>    Only model caches for the windows listed in <file>,\n");
+  fprintf(stderr, "                          one \"<start> <length>\" pair per line\n");
+  fprintf(stderr, "  --sample-warmup=<n>   Warm the caches for <n> instructions before each\n");
+  fprintf(stderr, "                          window [default 0]\n");
   fprintf(stderr, "  --extension=<name>    Specify RoCC Extension\n");
   fprintf(stderr, "  --extlib=<name>       Shared library to load\n");
   fprintf(stderr, "                        This flag can be used multiple times.\n");
@@ -131,7 +189,8 @@ void merge_overlapping_memory_regions(std::vector<std::pair<reg_t, mem_t*>>& mem
   }
 }
 
-static std::vector<std::pair<reg_t, mem_t*>> make_mems(const char* arg)
+static std::vector<std::pair<reg_t, mem_t*>> make_mems(const char* arg,
+    std::function<mem_t*(size_t)> new_mem)
 {
   // handle legacy mem argument
   char* p;
@@ -140,7 +199,7 @@ static std::vector<std::pair<reg_t, mem_t*>> make_mems(const char* arg)
     reg_t size = reg_t(mb) << 20;
     if (size != (size_t)size)
       throw std::runtime_error("Size would overflow size_t");
-    return std::vector<std::pair<reg_t, mem_t*>>(1, std::make_pair(reg_t(DRAM_BASE), new mem_t(size)));
+    return std::vector<std::pair<reg_t, mem_t*>>(1, std::make_pair(reg_t(DRAM_BASE), new_mem(size)));
   }
 
   // handle base/size tuples
@@ -167,7 +226,7 @@ static std::vector<std::pair<reg_t, mem_t*>> make_mems(const char* arg)
               base0, base0 + size0 - 1, PGSIZE / 1024, base, base + size - 1);
     }
 
-    res.push_back(std::make_pair(reg_t(base), new mem_t(size)));
+    res.push_back(std::make_pair(reg_t(base), new_mem(size)));
     if (!*p)
       break;
     if (*p != ',')
@@ -183,23 +242,49 @@ int main(int argc, char** argv)
 {
   bool debug = false;
   bool halted = false;
-  bool histogram = false;
   bool log = false;
   bool dump_dts = false;
   bool dtb_enabled = true;
   bool real_time_clint = false;
+  bool parallel = false;
+  bool jit = false;
+  bool host_fp = false;
+  size_t sync_quantum = 5000;
   size_t nprocs = 1;
   size_t initrd_size;
   reg_t initrd_start = 0, initrd_end = 0;
   reg_t start_pc = reg_t(-1);
   std::vector<std::pair<reg_t, mem_t*>> mems;
+  const char* mem_spec = "2048";
+  const char* mem_file = NULL;
+  bool hugepages = false;
+  uint64_t checkpoint_insns = 0;
+  const char* checkpoint_file = NULL;
+  const char* restore_file = NULL;
+  const char* fork_args = NULL;
+  uint64_t fork_insns = 0;
+  size_t fork_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  std::vector<sim_t::sample_window_t> sample_windows;
+  uint64_t sample_period = 0, sample_warmup = 0;
+  uint64_t bbv_interval = 0;
+  bool profile = false;
+  profile_format_t profile_format = PROFILE_HISTOGRAM;
+  std::string profile_path;
+  const char* callgraph_file = NULL;
+  const char* bbv_file = NULL;
   std::vector<std::pair<reg_t, abstract_device_t*>> plugin_devices;
   std::unique_ptr<icache_sim_t> ic;
   std::unique_ptr<dcache_sim_t> dc;
   std::unique_ptr<cache_sim_t> l2;
   bool log_cache = false;
+  bool tlb_stats = false;
+  size_t tlb_sets = 256, tlb_ways = 4;
   bool log_commits = false;
   const char *log_path = nullptr;
+  const char *commit_trace = nullptr;
+  bool log_windowed = false;
+  log_trigger_t log_start = {log_trigger_t::NONE, 0, ""};
+  log_trigger_t log_stop = {log_trigger_t::NONE, 0, ""};
   std::function<extension_t*()> extension;
   const char* initrd = NULL;
   const char* isa = DEFAULT_ISA;
@@ -279,10 +364,48 @@ int main(int argc, char** argv)
   parser.help(&suggest_help);
   parser.option('h', "help", 0, [&](const char* s){help(0);});
   parser.option('d', 0, 0, [&](const char* s){debug = true;});
-  parser.option('g', 0, 0, [&](const char* s){histogram = true;});
+  parser.option('g', 0, 0, [&](const char* s){profile = true;});
+  parser.option(0, "profile", 1, [&](const char* s){
+    const char* fp = strchr(s, ':');
+    if (!fp || !fp[1] || !parse_profile_format(std::string(s, fp), &profile_format)) {
+      fprintf(stderr, "--profile expects <format>:<file>\n");
+      exit(1);
+    }
+    profile = true;
+    profile_path = fp + 1;
+  });
   parser.option('l', 0, 0, [&](const char* s){log = true;});
+  parser.option(0, "callgraph", 1, [&](const char* s){callgraph_file = s;});
+  parser.option(0, "bbv", 1, [&](const char* s){
+    char* fp;
+    bbv_interval = strtoull(s, &fp, 0);
+    if (*fp != ':' || !fp[1] || bbv_interval == 0) {
+      fprintf(stderr, "--bbv expects <interval>:<file>\n");
+      exit(1);
+    }
+    bbv_file = fp + 1;
+  });
   parser.option('p', 0, 1, [&](const char* s){nprocs = atoi(s);});
-  parser.option('m', 0, 1, [&](const char* s){mems = make_mems(s);});
+  parser.option(0, "parallel", 0, [&](const char* s){parallel = true;});
+  parser.option(0, "sync-quantum", 1, [&](const char* s){sync_quantum = strtoull(s, 0, 0);});
+  parser.option(0, "jit", 0, [&](const char* s){jit = true;});
+  parser.option(0, "host-fp", 0, [&](const char* s){host_fp = true;});
+  parser.option('m', 0, 1, [&](const char* s){mem_spec = s;});
+  parser.option(0, "mem-file", 1, [&](const char* s){mem_file = s;});
+  parser.option(0, "hugepages", 0, [&](const char* s){hugepages = true;});
+  parser.option(0, "checkpoint", 1, [&](const char* s){
+    char* fp;
+    checkpoint_insns = strtoull(s, &fp, 0);
+    if (*fp != ':' || !fp[1]) {
+      fprintf(stderr, "--checkpoint expects <insns>:<file>\n");
+      exit(1);
+    }
+    checkpoint_file = fp + 1;
+  });
+  parser.option(0, "restore", 1, [&](const char* s){restore_file = s;});
+  parser.option(0, "fork-args", 1, [&](const char* s){fork_args = s;});
+  parser.option(0, "fork-at", 1, [&](const char* s){fork_insns = strtoull(s, 0, 0);});
+  parser.option(0, "fork-jobs", 1, [&](const char* s){fork_jobs = strtoull(s, 0, 0);});
   // I wanted to use --halted, but for some reason that doesn't work.
   parser.option('H', 0, 0, [&](const char* s){halted = true;});
   parser.option(0, "rbb-port", 1, [&](const char* s){use_rbb = true; rbb_port = atoi(s);});
@@ -292,6 +415,47 @@ int main(int argc, char** argv)
   parser.option(0, "dc", 1, [&](const char* s){dc.reset(new dcache_sim_t(s));});
   parser.option(0, "l2", 1, [&](const char* s){l2.reset(cache_sim_t::construct(s, "L2$"));});
   parser.option(0, "log-cache-miss", 0, [&](const char* s){log_cache = true;});
+  parser.option(0, "sample", 1, [&](const char* s){
+    char* lp;
+    sample_period = strtoull(s, &lp, 0);
+    uint64_t length = *lp == ':' ? strtoull(lp + 1, 0, 0) : 0;
+    if (*lp != ':' || length == 0 || length > sample_period) {
+      fprintf(stderr, "--sample expects <period>:<length>, with 0 < length <= period\n");
+      exit(1);
+    }
+    sample_windows = {{sample_period - length, length}};
+  });
+  parser.option(0, "simpoints", 1, [&](const char* s){
+    std::ifstream in(s);
+    if (!in) {
+      fprintf(stderr, "couldn't open %s\n", s);
+      exit(1);
+    }
+    sample_period = 0;
+    sample_windows.clear();
+    for (uint64_t start, length; in >> start >> length; )
+      if (length)
+        sample_windows.push_back({start, length});
+    if (!in.eof() || sample_windows.empty()) {
+      fprintf(stderr, "%s: expected pairs of <start> <length>\n", s);
+      exit(1);
+    }
+    std::sort(sample_windows.begin(), sample_windows.end(),
+              [](const sim_t::sample_window_t& a, const sim_t::sample_window_t& b) {
+                return a.start < b.start;
+              });
+  });
+  parser.option(0, "sample-warmup", 1, [&](const char* s){sample_warmup = strtoull(s, 0, 0);});
+  parser.option(0, "tlb", 1, [&](const char* s){
+    char* wp;
+    tlb_sets = strtoul(s, &wp, 10);
+    if (*wp != ':' || !isdigit(wp[1])) {
+      fprintf(stderr, "--tlb expects <sets>:<ways>\n");
+      exit(1);
+    }
+    tlb_ways = strtoul(wp + 1, 0, 10);
+    tlb_stats = true;
+  });
   parser.option(0, "isa", 1, [&](const char* s){isa = s;});
   parser.option(0, "priv", 1, [&](const char* s){priv = s;});
   parser.option(0, "varch", 1, [&](const char* s){varch = s;});
@@ -327,17 +491,87 @@ int main(int argc, char** argv)
       [&](const char* s){dm_config.support_haltgroups = false;});
   parser.option(0, "log-commits", 0,
                 [&](const char* s){log_commits = true;});
+  parser.option(0, "commit-trace", 1,
+                [&](const char* s){log_commits = true; commit_trace = s;});
   parser.option(0, "log", 1,
                 [&](const char* s){log_path = s;});
+  parser.option(0, "log-start", 1, [&](const char* s){
+    if (!parse_log_trigger(s, &log_start)) {
+      fprintf(stderr, "--log-start expects pc=<address|symbol>, insn=<n>, "
+                      "csr=<name|number> or marker=<n>\n");
+      exit(1);
+    }
+    log_windowed = true;
+  });
+  parser.option(0, "log-stop", 1, [&](const char* s){
+    if (!parse_log_trigger(s, &log_stop)) {
+      fprintf(stderr, "--log-stop expects pc=<address|symbol>, insn=<n>, "
+                      "csr=<name|number> or marker=<n>\n");
+      exit(1);
+    }
+    log_windowed = true;
+  });
 
   auto argv1 = parser.parse(argv);
   std::vector<std::string> htif_args(argv1, (const char*const*)argv + argc);
-  if (mems.empty())
-    mems = make_mems("2048");
+  // guest memory is backed by consecutive extents of the memory file
+  int mem_fd = -1;
+  size_t mem_file_offset = 0;
+  if (mem_file) {
+    mem_fd = open(mem_file, O_RDWR | O_CREAT, 0666);
+    if (mem_fd < 0) {
+      fprintf(stderr, "couldn't open %s: %s\n", mem_file, strerror(errno));
+      return 1;
+    }
+  }
+  mems = make_mems(mem_spec, [&](size_t size) {
+    struct stat st;
+    if (mem_fd >= 0 && fstat(mem_fd, &st) == 0 &&
+        (size_t)st.st_size < mem_file_offset + size &&
+        ftruncate(mem_fd, mem_file_offset + size) != 0)
+      throw std::runtime_error(std::string("couldn't extend ") + mem_file + ": " + strerror(errno));
+    mem_t* mem = new mem_t(size, hugepages, mem_fd, mem_file_offset);
+    mem_file_offset += size;
+    return mem;
+  });
+  if (mem_fd >= 0)
+    close(mem_fd);
 
   if (!*argv1)
     help();
 
+  if (parallel && (log || log_commits || ic || dc || l2)) {
+    fprintf(stderr, "--parallel cannot be combined with -l, --log-commits, "
+                    "or cache models\n");
+    exit(1);
+  }
+
+  if (!sample_windows.empty() && !ic && !dc && !l2) {
+    fprintf(stderr, "--sample and --simpoints require a cache model\n");
+    exit(1);
+  }
+
+  if (fork_insns && !fork_args) {
+    fprintf(stderr, "--fork-at requires --fork-args\n");
+    exit(1);
+  }
+
+  if (fork_args && mem_file) {
+    fprintf(stderr, "--fork-args cannot be combined with --mem-file, since "
+                    "forked children must not share target memory\n");
+    exit(1);
+  }
+
+  if (log_windowed && !log && !log_commits) {
+    fprintf(stderr, "--log-start and --log-stop require -l or --log-commits\n");
+    exit(1);
+  }
+
+  if (jit && log_commits) {
+    fprintf(stderr, "--jit cannot be combined with --log-commits\n");
+    exit(1);
+  }
+
   if (initrd && check_file_exists(initrd)) {
     initrd_size = get_file_size(initrd);
     for (auto& m : mems) {
@@ -375,13 +609,70 @@ int main(int argc, char** argv)
     if (ic) s.get_core(i)->get_mmu()->register_memtracer(&*ic);
     if (dc) s.get_core(i)->get_mmu()->register_memtracer(&*dc);
     if (extension) s.get_core(i)->register_extension(extension());
+    s.get_core(i)->get_mmu()->configure_tlb_l2(tlb_sets, tlb_ways);
+    if (bbv_file) {
+      std::string path = bbv_file;
+      if (nprocs > 1)
+        path += "." + std::to_string(i);
+      try {
+        s.get_core(i)->set_bbv(path, bbv_interval);
+      } catch (std::runtime_error& e) {
+        fprintf(stderr, "couldn't open %s\n", e.what());
+        exit(1);
+      }
+    }
   }
 
   s.set_debug(debug);
   s.configure_log(log, log_commits);
-  s.set_histogram(histogram);
+  if (commit_trace)
+    s.set_commit_trace(commit_trace);
+  if (log_windowed)
+    s.configure_log_window(log_start, log_stop);
+  if (profile)
+    s.configure_profile(profile_format, profile_path);
+  if (callgraph_file)
+    s.configure_callgraph(callgraph_file);
+  s.configure_parallel(parallel, sync_quantum);
+  s.set_jit(jit);
+  s.set_host_fp(host_fp);
+  if (checkpoint_file)
+    s.set_checkpoint(checkpoint_insns, checkpoint_file);
+  if (restore_file)
+    s.set_restore(restore_file);
+  if (!sample_windows.empty()) {
+    std::vector<cache_sim_t*> caches;
+    if (ic) caches.push_back(ic->get_cache());
+    if (dc) caches.push_back(dc->get_cache());
+    if (l2) caches.push_back(&*l2);
+    s.configure_sampling(sample_windows, sample_period, sample_warmup, caches);
+  }
+  if (fork_args) {
+    std::ifstream in(fork_args);
+    if (!in) {
+      fprintf(stderr, "couldn't open %s\n", fork_args);
+      exit(1);
+    }
+    std::vector<std::vector<std::string>> children;
+    for (std::string line; std::getline(in, line); ) {
+      std::istringstream words(line);
+      std::vector<std::string> args;
+      for (std::string w; words >> w; )
+        args.push_back(w);
+      if (!args.empty())
+        children.push_back(args);
+    }
+    s.set_fanout(children, fork_jobs);
+    s.set_fork_at(fork_insns);
+  }
 
   auto return_code = s.run();
+  s.finish_sampling();
+  s.write_profile();
+
+  if (tlb_stats)
+    for (size_t i = 0; i < nprocs; i++)
+      s.get_core(i)->get_mmu()->print_tlb_stats();
 
   for (auto& mem : mems)
     delete mem.second;